@@ -0,0 +1,415 @@
+/*
+Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/**
+ * Benchmarks for the Galogen pipeline.
+ *
+ * Measures loading the registry with each parser, the byte searches of the
+ * streaming parser with and without SIMD, and, for a matrix of targets,
+ * resolving features, applying extensions and running each output generator.
+ * Every measurement is repeated and reported as median and 95th
+ * percentile, so that runs before and after a change can be compared.
+ *
+ * Build from the repository root:
+ *   g++ -std=c++11 -O2 -pthread -o galogen_bench bench/galogen_bench.cpp \
+ *       third_party/tinyxml2.cpp
+ *
+ * Run:
+ *   ./galogen_bench [--registry third_party/gl.xml] [--iterations 15]
+ *                   [--filter <substring>] [--format text|json]
+ */
+
+// The benchmark needs Galogen's internals, so it is built from the same
+// translation unit.
+#define GALOGEN_LIBRARY 1
+#include "../galogen.cpp"
+
+#include <cmath>
+
+namespace galogen {
+namespace internal {
+
+struct BenchmarkOptions {
+  std::string registry_file_name = "third_party/gl.xml";
+  int iterations = 15;
+  std::string filter;
+  ReportFormat format = ReportFormat::kText;
+};
+
+// Times of all iterations of one measurement.
+struct BenchmarkResult {
+  std::string name;
+  std::vector<double> seconds;
+
+  // Value below which `fraction` of the samples lie (nearest rank).
+  double percentile(double fraction) const {
+    std::vector<double> sorted(seconds);
+    std::sort(sorted.begin(), sorted.end());
+    size_t rank = (size_t)std::ceil(fraction * sorted.size());
+    rank = std::min(std::max(rank, (size_t)1), sorted.size());
+    return sorted[rank - 1];
+  }
+};
+
+// A target of the benchmark matrix.
+struct BenchmarkTarget {
+  std::string api;
+  std::string version;
+  std::string profile;
+  bool all_extensions;
+
+  std::string name() const {
+    return api + " " + version + " " + profile +
+           (all_extensions ? " +exts" : "");
+  }
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+std::vector<BenchmarkTarget> benchmarkTargets() {
+  static const char *kGlVersions[] = {
+    "1.0", "1.1", "1.2", "1.3", "1.4", "1.5", "2.0", "2.1", "3.0", "3.1",
+    "3.2", "3.3", "4.0", "4.1", "4.2", "4.3", "4.4", "4.5", "4.6"
+  };
+  static const char *kGles2Versions[] = {"2.0", "3.0", "3.1", "3.2"};
+  std::vector<BenchmarkTarget> targets;
+  for (bool all_extensions : {false, true}) {
+    for (const char *version : kGlVersions) {
+      for (const char *profile : {"core", "compatibility"}) {
+        targets.push_back({"gl", version, profile, all_extensions});
+      }
+    }
+    targets.push_back({"gles1", "1.0", "compatibility", all_extensions});
+    for (const char *version : kGles2Versions) {
+      targets.push_back({"gles2", version, "compatibility", all_extensions});
+    }
+    targets.push_back({"glsc2", "2.0", "compatibility", all_extensions});
+  }
+  return targets;
+}
+
+// Loads the registry with the given parser, failing on errors.
+void loadOrFail(const BenchmarkOptions &options,
+                XmlParser parser,
+                bool lazy_commands,
+                Registry *registry) {
+  RegistryLoadOptions load_options;
+  load_options.file_name = options.registry_file_name;
+  load_options.parser = parser;
+  load_options.lazy_commands = lazy_commands;
+  std::string error;
+  FAIL_IF(!loadRegistry(load_options, registry, &error),
+          "%s\n",
+          error.c_str());
+}
+
+void benchmarkLoad(const BenchmarkOptions &options,
+                   std::vector<BenchmarkResult> *results) {
+  static const struct {
+    const char *name;
+    XmlParser parser;
+    bool lazy_commands;
+  } kConfigs[] = {
+    {"load streaming lazy", XmlParser::kStreaming, true},
+    {"load streaming", XmlParser::kStreaming, false},
+    {"load parallel lazy", XmlParser::kParallel, true},
+    {"load tinyxml2", XmlParser::kTinyXml2, false}
+  };
+  for (const auto &config : kConfigs) {
+    if (std::string(config.name).find(options.filter) == std::string::npos) {
+      continue;
+    }
+    BenchmarkResult result;
+    result.name = config.name;
+    for (int i = -1; i < options.iterations; ++i) {
+      Registry registry;
+      auto start = std::chrono::steady_clock::now();
+      loadOrFail(options, config.parser, config.lazy_commands, &registry);
+      if (i >= 0) {
+        result.seconds.push_back(secondsSince(start));
+      }
+    }
+    results->push_back(result);
+  }
+}
+
+// Measures the byte searches the streaming parser is built on, with and
+// without SIMD, over the whole registry file: finding every '<', '>' and '"',
+// and counting lines.
+void benchmarkScan(const BenchmarkOptions &options,
+                   std::vector<BenchmarkResult> *results) {
+  std::ifstream file(options.registry_file_name, std::ios::binary);
+  FAIL_IF(!file, "Failed to open %s\n", options.registry_file_name.c_str());
+  const std::string contents((std::istreambuf_iterator<char>(file)),
+                             std::istreambuf_iterator<char>());
+  const char *begin = contents.data();
+  const char *end = begin + contents.size();
+  static const struct {
+    const char *name;
+    const char* (*find_any_of)(const char*, const char*, char, char, char);
+    size_t (*count_byte)(const char*, const char*, char);
+  } kConfigs[] = {
+    {"scan", findAnyOf, countByte},
+    {"scan scalar", findAnyOfScalar, countByteScalar}
+  };
+  for (const auto &config : kConfigs) {
+    BenchmarkResult delimiters;
+    delimiters.name = std::string(config.name) + ": delimiters";
+    BenchmarkResult lines;
+    lines.name = std::string(config.name) + ": lines";
+    if (delimiters.name.find(options.filter) == std::string::npos &&
+        lines.name.find(options.filter) == std::string::npos) {
+      continue;
+    }
+    size_t expected_delimiters = 0;
+    size_t expected_lines = 0;
+    for (int i = -1; i < options.iterations; ++i) {
+      auto start = std::chrono::steady_clock::now();
+      size_t delimiter_count = 0;
+      for (const char *p = begin;
+           (p = config.find_any_of(p, end, '<', '>', '"')) < end;
+           ++p) {
+        ++delimiter_count;
+      }
+      double delimiter_seconds = secondsSince(start);
+      start = std::chrono::steady_clock::now();
+      size_t line_count = config.count_byte(begin, end, '\n');
+      double line_seconds = secondsSince(start);
+      if (i < 0) {
+        expected_delimiters = delimiter_count;
+        expected_lines = line_count;
+        continue;
+      }
+      // Using the results keeps them from being optimized away.
+      FAIL_IF(delimiter_count != expected_delimiters ||
+              line_count != expected_lines,
+              "%s: inconsistent results\n",
+              config.name);
+      delimiters.seconds.push_back(delimiter_seconds);
+      lines.seconds.push_back(line_seconds);
+    }
+    if (delimiters.name.find(options.filter) != std::string::npos) {
+      results->push_back(delimiters);
+    }
+    if (lines.name.find(options.filter) != std::string::npos) {
+      results->push_back(lines);
+    }
+  }
+}
+
+// Measures the phases of generating a target. Features and extensions are
+// resolved from scratch in every iteration; generators then run with the
+// resolved entities cached, as they would for the second target of a batch.
+void benchmarkTarget(const BenchmarkOptions &options,
+                     const Registry &registry,
+                     const GeneratorMap &generators,
+                     const BenchmarkTarget &target,
+                     std::vector<BenchmarkResult> *results) {
+  GenerationOptions generation_options;
+  generation_options.api_name = target.api;
+  generation_options.api_version = ApiVersion(target.version.c_str());
+  generation_options.profile = target.profile;
+  generation_options.filename = "bench";
+  const Symbol api = findSymbol(registry, target.api);
+  const Symbol profile = findSymbol(registry, target.profile);
+  const uint64_t api_bit = findApiBit(registry, target.api);
+  std::vector<const ExtensionInfo*> extensions;
+  if (target.all_extensions) {
+    for (const ExtensionInfo &extension : registry.extensions) {
+      if ((extension.supported_apis & api_bit) != 0) {
+        extensions.push_back(&extension);
+        generation_options.extensions.insert(extension.name.str());
+      }
+    }
+  }
+
+  std::vector<std::string> generator_names;
+  for (const auto &generator : generators) {
+    generator_names.push_back(generator.first);
+  }
+  std::sort(generator_names.begin(), generator_names.end());
+
+  BenchmarkResult features;
+  features.name = target.name() + ": features";
+  BenchmarkResult extension_result;
+  extension_result.name = target.name() + ": extensions";
+  std::vector<BenchmarkResult> generator_results(generator_names.size());
+  for (size_t g = 0; g < generator_names.size(); ++g) {
+    generator_results[g].name = target.name() + ": " + generator_names[g];
+  }
+
+  Registry *mutable_registry = const_cast<Registry*>(&registry);
+  for (int i = -1; i < options.iterations; ++i) {
+    mutable_registry->compiled_operations.clear();
+    mutable_registry->feature_levels.clear();
+    mutable_registry->api_views.clear();
+    std::string error;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+      std::lock_guard<std::mutex> lock(*registry.mutex);
+      FAIL_IF(findFeatureLevels(mutable_registry,
+                                api,
+                                profile,
+                                &error,
+                                nullptr) == nullptr,
+              "%s\n",
+              error.c_str());
+    }
+    double feature_seconds = secondsSince(start);
+
+    // With the feature levels cached, this is the cost of extensions.
+    EntityLists entity_lists;
+    start = std::chrono::steady_clock::now();
+    FAIL_IF(!resolveEntities(registry,
+                             api,
+                             profile,
+                             generation_options.api_version,
+                             extensions,
+                             nullptr,
+                             &entity_lists,
+                             &error,
+                             nullptr),
+            "%s\n",
+            error.c_str());
+    double extension_seconds = secondsSince(start);
+
+    std::vector<double> generator_seconds;
+    for (const std::string &generator_name : generator_names) {
+      std::unique_ptr<OutputGenerator> generator =
+          generators.at(generator_name)();
+      MemorySink sink;
+      start = std::chrono::steady_clock::now();
+      FAIL_IF(!generate(registry,
+                        generation_options,
+                        generator.get(),
+                        &sink,
+                        &error),
+              "%s: %s\n",
+              target.name().c_str(),
+              error.c_str());
+      generator_seconds.push_back(secondsSince(start));
+    }
+
+    // The first iteration only warms up caches and the allocator.
+    if (i >= 0) {
+      features.seconds.push_back(feature_seconds);
+      extension_result.seconds.push_back(extension_seconds);
+      for (size_t g = 0; g < generator_names.size(); ++g) {
+        generator_results[g].seconds.push_back(generator_seconds[g]);
+      }
+    }
+  }
+  results->push_back(features);
+  results->push_back(extension_result);
+  results->insert(results->end(),
+                  generator_results.begin(),
+                  generator_results.end());
+}
+
+void printResults(FILE *f,
+                  ReportFormat format,
+                  const std::vector<BenchmarkResult> &results) {
+  if (format == ReportFormat::kJson) {
+    fprintf(f, "{\"benchmarks\": [");
+    for (size_t i = 0; i < results.size(); ++i) {
+      const BenchmarkResult &result = results[i];
+      fprintf(f,
+              "%s\n  {\"name\": \"%s\", \"iterations\": %u, "
+              "\"median_ms\": %.3f, \"p95_ms\": %.3f}",
+              i == 0 ? "" : ",",
+              result.name.c_str(),
+              (unsigned)result.seconds.size(),
+              result.percentile(0.5) * 1e3,
+              result.percentile(0.95) * 1e3);
+    }
+    fprintf(f, "\n]}\n");
+  } else {
+    fprintf(f, "%-48s %10s %12s %12s\n",
+            "Benchmark", "Iterations", "Median ms", "P95 ms");
+    for (const BenchmarkResult &result : results) {
+      fprintf(f, "%-48s %10u %12.3f %12.3f\n",
+              result.name.c_str(),
+              (unsigned)result.seconds.size(),
+              result.percentile(0.5) * 1e3,
+              result.percentile(0.95) * 1e3);
+    }
+  }
+}
+
+void parseBenchmarkOptions(int argc, char **argv, BenchmarkOptions *options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    FAIL_IF(i + 1 >= argc, "Missing value for option %s\n", arg.c_str());
+    std::string value = argv[++i];
+    if (arg == "--registry") {
+      options->registry_file_name = value;
+    } else if (arg == "--iterations") {
+      options->iterations = atoi(value.c_str());
+      FAIL_IF(options->iterations <= 0,
+              "Invalid number of iterations \"%s\"\n",
+              value.c_str());
+    } else if (arg == "--filter") {
+      options->filter = value;
+    } else if (arg == "--format") {
+      if (value == "text") {
+        options->format = ReportFormat::kText;
+      } else if (value == "json") {
+        options->format = ReportFormat::kJson;
+      } else {
+        FAIL("Format must be either \"text\" or \"json\"\n");
+      }
+    } else {
+      FAIL("Unrecognized option: %s\n", arg.c_str());
+    }
+  }
+}
+
+}
+}
+
+int main(int argc, char **argv) {
+  galogen::internal::BenchmarkOptions options;
+  galogen::internal::parseBenchmarkOptions(argc, argv, &options);
+
+  std::vector<galogen::internal::BenchmarkResult> results;
+  galogen::internal::benchmarkLoad(options, &results);
+  galogen::internal::benchmarkScan(options, &results);
+
+  galogen::internal::GeneratorMap generators;
+  galogen::internal::createGenerators(generators);
+  galogen::internal::Registry registry;
+  galogen::internal::loadOrFail(options,
+                                galogen::internal::XmlParser::kStreaming,
+                                false,
+                                &registry);
+  for (const galogen::internal::BenchmarkTarget &target :
+       galogen::internal::benchmarkTargets()) {
+    if (target.name().find(options.filter) == std::string::npos) {
+      continue;
+    }
+    galogen::internal::benchmarkTarget(options,
+                                       registry,
+                                       generators,
+                                       target,
+                                       &results);
+  }
+  galogen::internal::printResults(stdout, options.format, results);
+  return 0;
+}
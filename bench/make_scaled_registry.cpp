@@ -0,0 +1,226 @@
+/*
+Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/**
+ * Synthesizes large registries for scaling tests.
+ *
+ * Writes a registry containing `factor` copies of every type, enumerant,
+ * group, command and extension of an input registry. Copy 0 is the original;
+ * in copy k, every entity name gets the suffix "_S<k>", and so do all
+ * references to entity names, so every copy is self-contained. Each
+ * <require> and <remove> element of a feature also lists the entities of all
+ * copies, so a target generated from the scaled registry is `factor` times
+ * the size of the original.
+ *
+ * Build from the repository root:
+ *   g++ -std=c++11 -O2 -o make_scaled_registry bench/make_scaled_registry.cpp \
+ *       third_party/tinyxml2.cpp
+ *
+ * Run:
+ *   ./make_scaled_registry third_party/gl.xml gl_x10.xml 10
+ *   ./galogen_bench --registry gl_x10.xml
+ */
+
+#include "../third_party/tinyxml2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define FAIL(...) {\
+  fprintf(stderr, "FATAL ERROR: " __VA_ARGS__ ); \
+  exit(1); \
+}
+
+#define FAIL_IF(cond, ...) { \
+  if ((cond)) { FAIL(__VA_ARGS__); } \
+}
+
+using tinyxml2::XMLDocument;
+using tinyxml2::XMLElement;
+
+namespace {
+
+// Returns the name of an entity in the given copy.
+std::string scaledName(const char *name, int copy) {
+  return std::string(name) + "_S" + std::to_string(copy);
+}
+
+void renameAttribute(XMLElement *element, const char *attribute, int copy) {
+  const char *value = element->Attribute(attribute);
+  if (value != nullptr && value[0] != '\0') {
+    element->SetAttribute(attribute, scaledName(value, copy).c_str());
+  }
+}
+
+// Renames the text of all children of `element` with the given tag.
+void renameChildText(XMLElement *element, const char *tag, int copy) {
+  for (XMLElement *child = element->FirstChildElement(tag);
+       child != nullptr;
+       child = child->NextSiblingElement(tag)) {
+    if (child->GetText() != nullptr) {
+      child->SetText(scaledName(child->GetText(), copy).c_str());
+    }
+  }
+}
+
+// Returns the child elements of `parent` with the given tag, or all child
+// elements if `tag` is null. Collected upfront, since copies are inserted
+// into the same parent.
+std::vector<XMLElement*> childElements(XMLElement *parent, const char *tag) {
+  std::vector<XMLElement*> children;
+  for (XMLElement *child = parent->FirstChildElement(tag);
+       child != nullptr;
+       child = child->NextSiblingElement(tag)) {
+    children.push_back(child);
+  }
+  return children;
+}
+
+XMLElement* cloneElement(XMLElement *element) {
+  return element->DeepClone(element->GetDocument())->ToElement();
+}
+
+void renameType(XMLElement *type, int copy) {
+  renameAttribute(type, "name", copy);
+  renameAttribute(type, "requires", copy);
+  renameChildText(type, "name", copy);
+}
+
+void renameEnums(XMLElement *enums, int copy) {
+  for (XMLElement *enumerant : childElements(enums, "enum")) {
+    renameAttribute(enumerant, "name", copy);
+    renameAttribute(enumerant, "alias", copy);
+  }
+}
+
+void renameGroup(XMLElement *group, int copy) {
+  renameAttribute(group, "name", copy);
+  for (XMLElement *enumerant : childElements(group, "enum")) {
+    renameAttribute(enumerant, "name", copy);
+  }
+}
+
+void renameCommand(XMLElement *command, int copy) {
+  for (XMLElement *proto : childElements(command, "proto")) {
+    renameChildText(proto, "name", copy);
+    renameChildText(proto, "ptype", copy);
+  }
+  for (XMLElement *param : childElements(command, "param")) {
+    renameAttribute(param, "group", copy);
+    renameChildText(param, "ptype", copy);
+  }
+  for (XMLElement *alias : childElements(command, "alias")) {
+    renameAttribute(alias, "name", copy);
+  }
+  for (XMLElement *vecequiv : childElements(command, "vecequiv")) {
+    renameAttribute(vecequiv, "name", copy);
+  }
+}
+
+// Renames a <type>, <enum> or <command> child of a <require> or <remove>
+// element.
+void renameEntityRef(XMLElement *entity_ref, int copy) {
+  renameAttribute(entity_ref, "name", copy);
+}
+
+void renameOperation(XMLElement *operation, int copy) {
+  for (XMLElement *entity_ref : childElements(operation, nullptr)) {
+    renameEntityRef(entity_ref, copy);
+  }
+}
+
+void renameExtension(XMLElement *extension, int copy) {
+  renameAttribute(extension, "name", copy);
+  for (XMLElement *operation : childElements(extension, nullptr)) {
+    renameOperation(operation, copy);
+  }
+}
+
+// Appends copies 1 to factor - 1 of every child of `section` with the given
+// tag to `section`.
+void scaleChildren(XMLElement *section,
+                   const char *tag,
+                   int factor,
+                   void (*rename)(XMLElement*, int)) {
+  std::vector<XMLElement*> originals = childElements(section, tag);
+  for (int copy = 1; copy < factor; ++copy) {
+    for (XMLElement *original : originals) {
+      XMLElement *clone = cloneElement(original);
+      rename(clone, copy);
+      section->InsertEndChild(clone);
+    }
+  }
+}
+
+void scaleRegistry(XMLElement *registry, int factor) {
+  XMLElement *last_enums = nullptr;
+  std::vector<XMLElement*> enums_blocks;
+  for (XMLElement *section : childElements(registry, nullptr)) {
+    const char *tag = section->Value();
+    if (strcmp(tag, "types") == 0) {
+      scaleChildren(section, "type", factor, renameType);
+    } else if (strcmp(tag, "groups") == 0) {
+      scaleChildren(section, "group", factor, renameGroup);
+    } else if (strcmp(tag, "commands") == 0) {
+      scaleChildren(section, "command", factor, renameCommand);
+    } else if (strcmp(tag, "extensions") == 0) {
+      scaleChildren(section, "extension", factor, renameExtension);
+    } else if (strcmp(tag, "enums") == 0) {
+      enums_blocks.push_back(section);
+      last_enums = section;
+    } else if (strcmp(tag, "feature") == 0) {
+      for (XMLElement *operation : childElements(section, nullptr)) {
+        scaleChildren(operation, nullptr, factor, renameEntityRef);
+      }
+    }
+  }
+  // Enumerants are grouped in <enums> blocks; copies of the blocks follow the
+  // last original one.
+  XMLElement *insert_after = last_enums;
+  for (int copy = 1; copy < factor; ++copy) {
+    for (XMLElement *enums : enums_blocks) {
+      XMLElement *clone = cloneElement(enums);
+      renameEnums(clone, copy);
+      registry->InsertAfterChild(insert_after, clone);
+      insert_after = clone;
+    }
+  }
+}
+
+}
+
+int main(int argc, char **argv) {
+  if (argc != 4) {
+    printf("Usage: make_scaled_registry <input registry> <output registry>"
+           " <factor>\n");
+    return 1;
+  }
+  int factor = atoi(argv[3]);
+  FAIL_IF(factor < 1, "Invalid scale factor \"%s\"\n", argv[3]);
+  XMLDocument document;
+  FAIL_IF(document.LoadFile(argv[1]) != tinyxml2::XML_SUCCESS,
+          "Failed to load file %s\n",
+          argv[1]);
+  XMLElement *registry = document.RootElement();
+  FAIL_IF(registry == nullptr, "Registry %s is empty\n", argv[1]);
+  scaleRegistry(registry, factor);
+  FAIL_IF(document.SaveFile(argv[2], true) != tinyxml2::XML_SUCCESS,
+          "Failed to write file %s\n",
+          argv[2]);
+  return 0;
+}
@@ -22,63 +22,452 @@ limitations under the License.
  *
  */
 
+#include "galogen.h"
 #include "third_party/tinyxml2.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <iostream>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <regex>
 #include <sstream>
+#include <fstream>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define GALOGEN_HAS_MMAP 1
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define GALOGEN_HAS_DIRENT 1
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#endif
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#define GALOGEN_HAS_SOCKETS 1
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GALOGEN_HAS_SSE2 1
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_WIN32)
+#include <malloc.h>
+#include <process.h>
+#define getpid _getpid
+#endif
+
 namespace galogen {
 
+// 64-bit FNV-1a hash.
+inline uint64_t hashBytes(const char *data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= (unsigned char)data[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Bump allocator. Individual allocations are never freed; all memory is
+// released at once when the arena is destroyed.
+class Arena {
+public:
+  Arena() = default;
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  Arena(Arena &&other) :
+    chunks_(std::move(other.chunks_)),
+    next_(other.next_),
+    remaining_(other.remaining_),
+    bytes_reserved_(other.bytes_reserved_) {
+    other.next_ = nullptr;
+    other.remaining_ = 0;
+    other.bytes_reserved_ = 0;
+  }
+
+  Arena& operator=(Arena &&other) {
+    chunks_ = std::move(other.chunks_);
+    next_ = other.next_;
+    remaining_ = other.remaining_;
+    bytes_reserved_ = other.bytes_reserved_;
+    other.next_ = nullptr;
+    other.remaining_ = 0;
+    other.bytes_reserved_ = 0;
+    return *this;
+  }
+
+  // Returns uninitialized, unaligned storage of the given size.
+  char* allocate(size_t size) {
+    if (size > remaining_) {
+      size_t chunk_size = std::max(kChunkSize, size);
+      chunks_.emplace_back(new char[chunk_size]);
+      next_ = chunks_.back().get();
+      remaining_ = chunk_size;
+      bytes_reserved_ += chunk_size;
+    }
+    char *result = next_;
+    next_ += size;
+    remaining_ -= size;
+    return result;
+  }
+
+  // Takes over the memory of `other`, which stays valid for as long as this
+  // arena exists. Further allocations from `other` start a new chunk.
+  void absorb(Arena &&other) {
+    for (std::unique_ptr<char[]> &chunk : other.chunks_) {
+      chunks_.push_back(std::move(chunk));
+    }
+    bytes_reserved_ += other.bytes_reserved_;
+    other.chunks_.clear();
+    other.next_ = nullptr;
+    other.remaining_ = 0;
+    other.bytes_reserved_ = 0;
+  }
+
+  // Total size of the chunks obtained from the heap.
+  size_t bytesReserved() const { return bytes_reserved_; }
+
+private:
+  static const size_t kChunkSize = 256 * 1024;
+
+  std::vector<std::unique_ptr<char[]>> chunks_;
+  char *next_ = nullptr;
+  size_t remaining_ = 0;
+  size_t bytes_reserved_ = 0;
+};
+
+const size_t Arena::kChunkSize;
+
+// An interned string. All names and C code fragments in the registry are
+// stored as symbols. Two symbols from the same SymbolTable are equal if and
+// only if they refer to the same storage, so comparing or hashing a symbol
+// costs the same as comparing or hashing a pointer.
+class Symbol {
+public:
+  Symbol() : str_("") {}
+
+  const char* c_str() const { return str_; }
+  std::string str() const { return std::string(str_, size()); }
+  bool empty() const { return str_[0] == '\0'; }
+
+  // Length of the string, excluding the terminating NUL.
+  size_t size() const {
+    uint32_t size = 0;
+    if (!empty()) {
+      memcpy(&size, str_ - sizeof(size), sizeof(size));
+    }
+    return size;
+  }
+
+  bool operator==(Symbol other) const { return str_ == other.str_; }
+  bool operator!=(Symbol other) const { return str_ != other.str_; }
+  bool operator==(const char *other) const { return strcmp(str_, other) == 0; }
+  bool operator!=(const char *other) const { return !(*this == other); }
+  bool operator==(const std::string &other) const { return other == str_; }
+  bool operator!=(const std::string &other) const { return other != str_; }
+
+private:
+  friend class SymbolTable;
+  explicit Symbol(const char *str) : str_(str) {}
+
+  // Points into a SymbolTable's arena, right after the 32-bit length of the
+  // string. The empty symbol points to a string literal instead.
+  const char *str_;
+};
+
+struct SymbolHash {
+  size_t operator()(Symbol symbol) const {
+    return std::hash<const char*>()(symbol.c_str());
+  }
+};
+
+// Owns the storage for interned strings. Strings are copied into an arena and
+// indexed by open-addressing hash tables, so interning a string does not
+// allocate unless the arena or the index need to grow. Strings that already
+// have the arena's layout, such as those in a memory-mapped snapshot, can be
+// indexed in place instead (see adopt()). Symbols remain valid for as long as
+// the table that created them exists; moving the table does not invalidate
+// them.
+class SymbolTable {
+public:
+  SymbolTable() = default;
+  SymbolTable(const SymbolTable&) = delete;
+  SymbolTable& operator=(const SymbolTable&) = delete;
+  SymbolTable(SymbolTable&&) = default;
+  SymbolTable& operator=(SymbolTable&&) = default;
+
+  Symbol intern(const char *str, size_t length) {
+    return insert(str, length, true);
+  }
+
+  Symbol intern(const char *str) { return intern(str, strlen(str)); }
+  Symbol intern(const std::string &str) {
+    return intern(str.data(), str.size());
+  }
+
+  // Returns the symbol for the given string, or an empty symbol if the string
+  // has never been interned.
+  Symbol find(const char *str, size_t length) const {
+    if (length == 0) {
+      return Symbol();
+    }
+    uint64_t hash = hashBytes(str, length);
+    const Shard &shard = shards_[shardIndex(hash)];
+    if (shard.slots.empty()) {
+      return Symbol();
+    }
+    const Slot *slot = shard.findSlot(str, length, hash);
+    return slot->str == nullptr ? Symbol() : Symbol(slot->str);
+  }
+
+  Symbol find(const std::string &str) const {
+    return find(str.data(), str.size());
+  }
+
+  // Interns a string without copying it. Like strings in the arena, `str`
+  // must be NUL-terminated and preceded by its length as a uint32_t, and it
+  // must outlive the table. If an equal string was interned before, returns
+  // the existing symbol.
+  Symbol adopt(const char *str, size_t length) {
+    return insert(str, length, false);
+  }
+
+  // Makes room for `count` more symbols, so that the index does not have to
+  // grow repeatedly while they are interned.
+  void reserve(size_t count) {
+    for (Shard &shard : shards_) {
+      shard.reserve(count / kShardCount + 1);
+    }
+  }
+
+  // Strings are spread over this many shards by hash, so that tables can be
+  // merged shard by shard.
+  static const size_t kShardCount = 32;
+
+  // Adds the strings of `other` that fall into the given shard to this table,
+  // without copying them. Strings that this table already holds are not
+  // added; instead, a pair of the symbol of `other` and the existing one is
+  // appended to `*duplicates`. Calls for different shards may run
+  // concurrently. Once all shards have been merged, absorbStorage() must be
+  // called.
+  void absorbShard(size_t shard_index,
+                   const SymbolTable &other,
+                   std::vector<std::pair<Symbol, Symbol>> *duplicates) {
+    Shard &shard = shards_[shard_index];
+    const Shard &other_shard = other.shards_[shard_index];
+    shard.reserve(other_shard.count);
+    for (const Slot &other_slot : other_shard.slots) {
+      if (other_slot.str == nullptr) {
+        continue;
+      }
+      Slot *slot =
+          shard.findSlot(other_slot.str, other_slot.length, other_slot.hash);
+      if (slot->str == nullptr) {
+        *slot = other_slot;
+        ++shard.count;
+      } else {
+        duplicates->emplace_back(Symbol(other_slot.str), Symbol(slot->str));
+      }
+    }
+  }
+
+  // Takes over the storage of a table whose shards have been merged with
+  // absorbShard(). `other` must not be used afterwards, but its symbols stay
+  // valid.
+  void absorbStorage(SymbolTable &&other) {
+    arena_.absorb(std::move(other.arena_));
+    for (Shard &shard : other.shards_) {
+      shard = Shard();
+    }
+  }
+
+  size_t size() const {
+    size_t count = 0;
+    for (const Shard &shard : shards_) {
+      count += shard.count;
+    }
+    return count;
+  }
+
+  // Memory used by the table, in bytes.
+  size_t bytesReserved() const {
+    size_t bytes = arena_.bytesReserved();
+    for (const Shard &shard : shards_) {
+      bytes += shard.slots.size() * sizeof(Slot);
+    }
+    return bytes;
+  }
+
+private:
+  struct Slot {
+    uint64_t hash = 0;
+    const char *str = nullptr;
+    uint32_t length = 0;
+  };
+
+  // Open-addressing index of the strings whose hashes start with the shard's
+  // index.
+  struct Shard {
+    std::vector<Slot> slots;
+    size_t count = 0;
+
+    // Returns the slot holding the given string, or the empty slot where it
+    // would have to be inserted.
+    const Slot* findSlot(const char *str, size_t length, uint64_t hash) const {
+      size_t mask = slots.size() - 1;
+      for (size_t i = (size_t)hash & mask; ; i = (i + 1) & mask) {
+        const Slot &slot = slots[i];
+        if (slot.str == nullptr ||
+            (slot.hash == hash && slot.length == length &&
+             memcmp(slot.str, str, length) == 0)) {
+          return &slot;
+        }
+      }
+    }
+
+    Slot* findSlot(const char *str, size_t length, uint64_t hash) {
+      return const_cast<Slot*>(
+          static_cast<const Shard*>(this)->findSlot(str, length, hash));
+    }
+
+    void reserve(size_t extra) {
+      while ((count + extra) * 2 > slots.size()) {
+        grow();
+      }
+    }
+
+    void grow() {
+      std::vector<Slot> old_slots(std::max<size_t>(slots.size() * 2, 32));
+      old_slots.swap(slots);
+      size_t mask = slots.size() - 1;
+      for (const Slot &slot : old_slots) {
+        if (slot.str != nullptr) {
+          size_t i = (size_t)slot.hash & mask;
+          while (slots[i].str != nullptr) { i = (i + 1) & mask; }
+          slots[i] = slot;
+        }
+      }
+    }
+  };
+
+  // Uses the top bits of the hash, since the bottom bits select the slot.
+  static size_t shardIndex(uint64_t hash) {
+    return (size_t)(hash >> 59);
+  }
+
+  Symbol insert(const char *str, size_t length, bool copy) {
+    if (length == 0) {
+      return Symbol();
+    }
+    uint64_t hash = hashBytes(str, length);
+    Shard &shard = shards_[shardIndex(hash)];
+    shard.reserve(1);
+    Slot *slot = shard.findSlot(str, length, hash);
+    if (slot->str == nullptr) {
+      uint32_t stored_length = (uint32_t)length;
+      const char *stored_str = str;
+      if (copy) {
+        char *storage = arena_.allocate(sizeof(stored_length) + length + 1);
+        memcpy(storage, &stored_length, sizeof(stored_length));
+        memcpy(storage + sizeof(stored_length), str, length);
+        storage[sizeof(stored_length) + length] = '\0';
+        stored_str = storage + sizeof(stored_length);
+      }
+      slot->hash = hash;
+      slot->str = stored_str;
+      slot->length = stored_length;
+      ++shard.count;
+    }
+    return Symbol(slot->str);
+  }
+
+  Shard shards_[kShardCount];
+  Arena arena_;
+};
+
+const size_t SymbolTable::kShardCount;
+
 // Information about an API type, such as GLuint or GLfloat.
 struct TypeInfo {  
   // Name of this type.
-  std::string name;
+  Symbol name;
   
   // Legal C code for type declaration.
-  std::string type_cdecl;
+  Symbol type_cdecl;
   
   // Name of another type that this type requires.
-  std::string prerequisite_type;
+  Symbol prerequisite_type;
   
   // API name for which this type definition applies.
-  std::string api;
+  Symbol api;
 };
 
 // Information about an enumerant, i.e. GL_TEXTURE_2D.
 struct EnumerantInfo {  
   // Name of this enumerant.
-  std::string name;
+  Symbol name;
   
   // Alternative name for this enumerant.
-  std::string alias;
+  Symbol alias;
   
   // Value of this enumerant.
-  std::string value;
+  Symbol value;
   
   // Legal C suffix to append to the value;
-  std::string suffix;
+  Symbol suffix;
   
   // API name for which this enumerant definition applies.
-  std::string api;
+  Symbol api;
 };
 
 // Information about enumerant group.
 struct GroupInfo {
    // Name of the group, i.e. "AccumOp".
-   std::string name;
+   Symbol name;
    
    // List of enumerants that are members of this group.
    std::vector<const EnumerantInfo*> enums;
+
+   // Names of the enumerants that are members of this group, as listed in the
+   // registry. Unlike `enums`, these do not depend on the API.
+   std::vector<Symbol> enum_names;
    
    // Always empty.
-   std::string api;
+   Symbol api;
 };
 
 
@@ -87,19 +476,19 @@ struct CommandInfo {
   // Information about a command parameter.
   struct ParamInfo {    
     // Name of the parameter.
-    std::string name;
+    Symbol name;
     
     // The full C type of the parameter (e.g. "const GLfloat*").
-    std::string ctype;
+    Symbol ctype;
     
     // Name of the API type that this parameter's type references.
     // For example, if ctype is "const GLfloat*", this will be "GLfloat".
     // If ctype doesn't reference any API-specific types (e.g. "const void*"),
     // this field will be empty.
-    std::string referenced_api_type;
+    Symbol referenced_api_type;
     
     // Group of this parameter.
-    std::string group;
+    Symbol group;
     
     // According to official docs, "parameter length, either an integer
     // specifying the number of elements of the parameter r a complex string
@@ -107,36 +496,36 @@ struct CommandInfo {
     // is computed as a combination of other command parameter values, and
     // possibly current GL state as well."
     // Take from that what you will.
-    std::string len;
+    Symbol len;
   };
    
   // Name of this command.
-  std::string name;
+  Symbol name;
   
   // Corresponding C function prototype, up to and including the function name,
   // but not the parameters.
-  std::string prototype;
+  Symbol prototype;
   
   // C type returned by this command, e.g. "const GLchar*".
-  std::string return_ctype;
+  Symbol return_ctype;
   
   // API-specific type, such as GLuint, referenced by this command's return
   // type. If the command's return type doesn't reference any API-specific types
   // (e.g. "void"), this field is empty.
-  std::string referenced_api_type;
+  Symbol referenced_api_type;
   
   // List of this command's parameters.
   std::vector<ParamInfo> parameters;
  
   // Name of another command that this command is an alias of.
-  std::string alias;
+  Symbol alias;
   
   // Name of another command that is the vector equivalent for
   // this command.
-  std::string vecequiv;
+  Symbol vecequiv;
    
   // Always empty.
-  std::string api;
+  Symbol api;
 };
 
 // If you want to write a custom output generator for Galogen, you must
@@ -160,6 +549,31 @@ public:
   
   // Invoked at the end of output generation.
   virtual void end(){}
+
+  // Sizes of the generated header and source, for statistics. Generators
+  // that don't produce these files may return 0.
+  virtual size_t headerBytes() const { return 0; }
+  virtual size_t sourceBytes() const { return 0; }
+
+  // Sets where generated files go. Invoked before start().
+  void setOutputSink(OutputSink *sink) { sink_ = sink; }
+
+  // The first error that occurred while writing files, if any.
+  const std::string& error() const { return error_; }
+
+protected:
+  // Hands a generated file to the output sink. Generators should write their
+  // files with this function rather than opening files themselves.
+  void writeFile(const std::string &file_name, const std::string &contents) {
+    std::string error;
+    if (!sink_->write(file_name, contents, &error) && error_.empty()) {
+      error_ = error;
+    }
+  }
+
+private:
+  OutputSink *sink_ = nullptr;
+  std::string error_;
 };
 
 #define FAIL(...) {\
@@ -171,516 +585,5516 @@ public:
   if ((cond)) { FAIL(__VA_ARGS__); } \
 }
 
-// ----------------------------------------------------------------------------
+// Formats an error message like printf().
+std::string formatMessage(const char *format, ...) {
+  va_list args;
+  va_list args_copy;
+  va_start(args, format);
+  va_copy(args_copy, args);
+  int length = vsnprintf(nullptr, 0, format, args);
+  va_end(args);
+  std::string message;
+  if (length > 0) {
+    message.resize((size_t)length + 1);
+    vsnprintf(&message[0], message.size(), format, args_copy);
+    message.resize((size_t)length);
+  }
+  va_end(args_copy);
+  return message;
+}
+
+// ----------------------------------------------------------------------------
+
+namespace internal {
+
+// An API entity is a type, enum or command.
+// An entity is defined by data extracted from its corresponding XML element.
+// However, the same entity may be represented by differently in
+// different APIs (e.g. an enum might have different values in GL vs GL ES).
+template <class T>
+class ApiEntity {
+public:
+  void add(const T &e) { set_.push_back(e); }
+  void add(T &&e) { set_.push_back(std::move(e)); }
+  
+  const T* get(Symbol api) const {
+    const T *result = nullptr;
+    for (const T &e : set_) {
+      if ((e.api.empty()  && result == nullptr) ||
+          (!e.api.empty() && e.api == api)) {
+        result = &e;
+      } 
+    }
+    return result;
+  }
+
+  // All known definitions of this entity, in registry order.
+  const std::vector<T>& variants() const { return set_; }
+  std::vector<T>& variants() { return set_; }
+
+  // Adds all definitions of `other`, which describes the same entity.
+  void append(ApiEntity &&other) {
+    for (T &e : other.set_) {
+      set_.push_back(std::move(e));
+    }
+  }
+
+private:
+  std::vector<T> set_;
+};
+
+// Maps names to API entities.
+template <class T>
+using EntityMap = std::unordered_map<Symbol, ApiEntity<T>, SymbolHash>;
+
+// Set of entity names.
+using EntitySet = std::unordered_set<Symbol, SymbolHash>;
+
+// Kinds of API entities.
+enum class EntityKind : uint32_t {
+  kType,
+  kEnum,
+  kCommand,
+  kGroup,
+  // Any other element inside of a <require> or <remove>. Ignored.
+  kOther
+};
+
+const size_t kEntityKindCount = 5;
+
+EntityKind entityKindFromTag(const char *tag) {
+  if (strcmp(tag, "type") == 0) {
+    return EntityKind::kType;
+  } else if (strcmp(tag, "enum") == 0) {
+    return EntityKind::kEnum;
+  } else if (strcmp(tag, "command") == 0) {
+    return EntityKind::kCommand;
+  } else if (strcmp(tag, "group") == 0) {
+    return EntityKind::kGroup;
+  }
+  return EntityKind::kOther;
+}
+
+// Holds one T for each kind of entity.
+template <class T>
+class PerEntityKind {
+public:
+  T& operator[](EntityKind kind) { return items_[(size_t)kind]; }
+  const T& operator[](EntityKind kind) const { return items_[(size_t)kind]; }
+
+private:
+  T items_[kEntityKindCount];
+};
+
+// Dense numbering of the entities of one kind, so that sets of entities can
+// be represented as bitsets. IDs are assigned in the order in which names are
+// first seen.
+struct EntityIds {
+  uint32_t get(Symbol name) {
+    auto inserted = ids.emplace(name, (uint32_t)names.size());
+    if (inserted.second) {
+      names.push_back(name);
+    }
+    return inserted.first->second;
+  }
+
+  std::unordered_map<Symbol, uint32_t, SymbolHash> ids;
+
+  // Names indexed by ID.
+  std::vector<Symbol> names;
+};
+
+// Set of entity IDs.
+class EntityBitset {
+public:
+  void insert(uint32_t id) {
+    if (id / 64 >= words_.size()) {
+      words_.resize(id / 64 + 1);
+    }
+    words_[id / 64] |= 1ull << (id % 64);
+  }
+
+  bool contains(uint32_t id) const {
+    return id / 64 < words_.size() && (words_[id / 64] >> (id % 64) & 1) != 0;
+  }
+
+  void insertAll(const EntityBitset &other) {
+    if (other.words_.size() > words_.size()) {
+      words_.resize(other.words_.size());
+    }
+    for (size_t i = 0; i < other.words_.size(); ++i) {
+      words_[i] |= other.words_[i];
+    }
+  }
+
+  void eraseAll(const EntityBitset &other) {
+    size_t size = std::min(words_.size(), other.words_.size());
+    for (size_t i = 0; i < size; ++i) {
+      words_[i] &= ~other.words_[i];
+    }
+  }
+
+  // Removes all IDs that are not in `other`.
+  void retainAll(const EntityBitset &other) {
+    if (words_.size() > other.words_.size()) {
+      words_.resize(other.words_.size());
+    }
+    for (size_t i = 0; i < words_.size(); ++i) {
+      words_[i] &= other.words_[i];
+    }
+  }
+
+  // Calls f for every ID in the set, in increasing order.
+  template <class F>
+  void forEach(F f) const {
+    for (size_t i = 0; i < words_.size(); ++i) {
+      uint64_t word = words_[i];
+      for (uint32_t bit = 0; word != 0; ++bit, word >>= 1) {
+        if (word & 1) {
+          f((uint32_t)(i * 64 + bit));
+        }
+      }
+    }
+  }
+
+private:
+  std::vector<uint64_t> words_;
+};
+
+using EntityBitsets = PerEntityKind<EntityBitset>;
+
+// Convenience class for comparing API versions.
+class ApiVersion {
+public:
+  ApiVersion() = default;
+  explicit ApiVersion(const char *version_string) {
+    static std::regex expr("^([0-9]+)\\.([0-9]+)$",
+                           std::regex_constants::ECMAScript);
+    std::cmatch match; 
+    std::regex_match(version_string, match, expr);
+    if (match.size() == 3) {
+      ver_maj_ = atoi(match[1].str().c_str());
+      ver_min_ = atoi(match[2].str().c_str());
+      valid_ = true;
+    }
+  }
+
+  bool operator<=(const ApiVersion &other) const {
+    if (ver_maj_ < other.ver_maj_) {
+      return true;
+    } else if (ver_maj_ == other.ver_maj_) {
+      return ver_min_ <= other.ver_min_;
+    }
+    return false;
+  }
+  
+  bool operator>(const ApiVersion &other) const {
+    return !(*this <= other);
+  }
+
+  bool valid() const { return valid_; }
+
+  int maj() const { return ver_maj_; }
+  int min() const { return ver_min_; }
+
+private:
+  int ver_maj_ = 0;
+  int ver_min_ = 0;
+  bool valid_ = false;
+};
+
+// A <require> or <remove> element inside of a feature or an extension.
+struct OperationInfo {
+  // Reference to an API entity, e.g. <command name="glBindTexture"/>.
+  struct EntityRef {
+    // Kind of the referenced entity.
+    EntityKind kind;
+
+    // Name of the referenced entity.
+    Symbol name;
+  };
+
+  // True if this is a <require> element, false if it is a <remove> element.
+  bool require = true;
+
+  // Profile that this operation is restricted to. Empty if the operation
+  // applies to all profiles.
+  Symbol profile;
+
+  // Entities added or removed by this operation, in registry order.
+  std::vector<EntityRef> entities;
+};
+
+// Information about an API version, i.e. GL_VERSION_4_5.
+struct FeatureInfo {
+  // Name of the API this feature belongs to, e.g. "gles2".
+  Symbol api;
+
+  // Name of this feature.
+  Symbol name;
+
+  // Version number string, e.g. "4.5".
+  Symbol number;
+
+  // Changes against the previous version of the API.
+  std::vector<OperationInfo> operations;
+};
+
+// Information about an extension, i.e. GL_ARB_direct_state_access.
+struct ExtensionInfo {
+  // Name of this extension.
+  Symbol name;
+
+  // Names of APIs supporting this extension, separated by '|', e.g.
+  // "gl|glcore|gles2".
+  Symbol supported;
+
+  // Bits of the APIs listed in `supported` (see Registry::api_names).
+  uint64_t supported_apis = 0;
+
+  // Entities introduced or removed by this extension.
+  std::vector<OperationInfo> operations;
+};
+
+// Read-only view of a file's contents. Uses mmap where available, and falls
+// back to reading the whole file into memory otherwise.
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+#if defined(GALOGEN_HAS_MMAP)
+    if (mapping_ != nullptr) {
+      munmap(mapping_, size_);
+    }
+#endif
+  }
+
+  // Returns false if the file could not be opened or read.
+  bool open(const char *path) {
+#if defined(GALOGEN_HAS_MMAP)
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return false;
+    }
+    size_ = (size_t)st.st_size;
+    if (size_ > 0) {
+      void *mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping != MAP_FAILED) {
+        mapping_ = mapping;
+        data_ = (const char*)mapping;
+      }
+    }
+    close(fd);
+    if (mapping_ != nullptr || size_ == 0) {
+      return true;
+    }
+#endif
+    FILE *f = fopen(path, "rb");
+    if (f == nullptr) {
+      return false;
+    }
+    char chunk[65536];
+    size_t bytes_read;
+    while ((bytes_read = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+      buffer_.insert(buffer_.end(), chunk, chunk + bytes_read);
+    }
+    bool ok = ferror(f) == 0;
+    fclose(f);
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    return ok;
+  }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const char *data_ = "";
+  size_t size_ = 0;
+  void *mapping_ = nullptr;
+  std::vector<char> buffer_;
+};
+
+// Text buffer for generated code. Appending does not allocate unless the
+// buffer needs to grow.
+class OutputBuffer {
+public:
+  void clear() { data_.clear(); }
+  void reserve(size_t size) { data_.reserve(size); }
+  const std::string& contents() const { return data_; }
+
+  OutputBuffer& operator<<(const char *s) {
+    data_.append(s, strlen(s));
+    return *this;
+  }
+
+  OutputBuffer& operator<<(char c) {
+    data_.push_back(c);
+    return *this;
+  }
+
+  OutputBuffer& operator<<(Symbol s) {
+    data_.append(s.c_str(), s.size());
+    return *this;
+  }
+
+  OutputBuffer& operator<<(const std::string &s) {
+    data_.append(s);
+    return *this;
+  }
+
+  OutputBuffer& operator<<(const OutputBuffer &other) {
+    data_.append(other.data_);
+    return *this;
+  }
+
+  OutputBuffer& operator<<(int value) {
+    char digits[16];
+    int length = snprintf(digits, sizeof(digits), "%d", value);
+    data_.append(digits, (size_t)length);
+    return *this;
+  }
+
+private:
+  std::string data_;
+};
+
+// Creates a new temporary file next to `path` and opens it for writing. The
+// name is unique to the call, so concurrent writers of the same file, in this
+// process or others, never share a temporary file. Unlike mkstemp(), the file
+// gets the permissions a new file would get, as it replaces `path`. Returns
+// nullptr on failure.
+FILE* createTempFile(const std::string &path, std::string *temp_path) {
+  static std::atomic<unsigned> counter(0);
+  for (int attempt = 0; attempt < 100; ++attempt) {
+    *temp_path = path + "." + std::to_string(getpid()) + "." +
+                 std::to_string(counter++) + ".tmp";
+#if defined(GALOGEN_HAS_MMAP)
+    int fd = open(temp_path->c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd >= 0) {
+      FILE *f = fdopen(fd, "wb");
+      if (f == nullptr) {
+        close(fd);
+        remove(temp_path->c_str());
+      }
+      return f;
+    }
+    // Left behind by a process that had the same ID.
+    if (errno != EEXIST) {
+      return nullptr;
+    }
+#else
+    // The counter makes the name unique within the process.
+    return fopen(temp_path->c_str(), "wb");
+#endif
+  }
+  return nullptr;
+}
+
+// Writes `contents` to the file at `path`, unless the file already has
+// exactly these contents. Leaving unchanged files alone keeps their
+// modification time, so build systems don't rebuild everything depending on
+// them. The file is replaced atomically. Returns false on failure.
+bool writeFileIfChanged(const std::string &path, const std::string &contents) {
+#if defined(_WIN32)
+  // Match what writing in text mode would produce.
+  std::string data;
+  data.reserve(contents.size() + contents.size() / 16);
+  for (char c : contents) {
+    if (c == '\n') {
+      data.push_back('\r');
+    }
+    data.push_back(c);
+  }
+#else
+  const std::string &data = contents;
+#endif
+  {
+    MappedFile existing;
+    if (existing.open(path.c_str()) && existing.size() == data.size() &&
+        memcmp(existing.data(), data.data(), data.size()) == 0) {
+      return true;
+    }
+  }
+  std::string temp_path;
+  FILE *f = createTempFile(path, &temp_path);
+  if (f == nullptr) {
+    return false;
+  }
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  ok = (fclose(f) == 0) && ok;
+#if defined(_WIN32)
+  remove(path.c_str());
+#endif
+  ok = ok && rename(temp_path.c_str(), path.c_str()) == 0;
+  if (!ok) {
+    remove(temp_path.c_str());
+  }
+  return ok;
+}
+
+// Formats in which timings and statistics can be reported.
+enum class ReportFormat {
+  kNone,
+  kText,
+  kJson
+};
+
+// Returns the CPU time used by the calling thread, in seconds. Falls back to
+// the CPU time of the whole process where per-thread time is not available.
+double threadCpuTime() {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+  timespec time;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0) {
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+  }
+#endif
+  return (double)clock() / CLOCKS_PER_SEC;
+}
+
+// Wall and CPU time spent in each phase of a run, summed over all targets.
+// Phases are reported in the order in which they were first entered. Safe to
+// use from multiple threads.
+class Timings {
+public:
+  void add(const char *phase, double wall_seconds, double cpu_seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto phase_it = std::find_if(phases_.begin(), phases_.end(),
+                                 [phase](const Phase &p) {
+                                   return strcmp(p.name, phase) == 0;
+                                 });
+    if (phase_it == phases_.end()) {
+      phases_.emplace_back();
+      phase_it = phases_.end() - 1;
+      phase_it->name = phase;
+    }
+    ++phase_it->count;
+    phase_it->wall_seconds += wall_seconds;
+    phase_it->cpu_seconds += cpu_seconds;
+  }
+
+  void print(FILE *f, ReportFormat format) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (format == ReportFormat::kJson) {
+      fprintf(f, "{\"phases\": [");
+      for (size_t i = 0; i < phases_.size(); ++i) {
+        const Phase &phase = phases_[i];
+        fprintf(f,
+                "%s\n  {\"name\": \"%s\", \"count\": %u, "
+                "\"wall_ms\": %.3f, \"cpu_ms\": %.3f}",
+                i == 0 ? "" : ",",
+                phase.name,
+                phase.count,
+                phase.wall_seconds * 1e3,
+                phase.cpu_seconds * 1e3);
+      }
+      fprintf(f, "\n]}\n");
+    } else {
+      fprintf(f, "%-32s %8s %12s %12s\n", "Phase", "Count", "Wall ms", "CPU ms");
+      for (const Phase &phase : phases_) {
+        fprintf(f, "%-32s %8u %12.3f %12.3f\n",
+                phase.name,
+                phase.count,
+                phase.wall_seconds * 1e3,
+                phase.cpu_seconds * 1e3);
+      }
+    }
+  }
+
+private:
+  struct Phase {
+    const char *name = nullptr;
+    unsigned count = 0;
+    double wall_seconds = 0.0;
+    double cpu_seconds = 0.0;
+  };
+
+  mutable std::mutex mutex_;
+  std::vector<Phase> phases_;
+};
+
+// Adds the time between its construction and destruction to a phase. Does
+// nothing if `timings` is null. Phase names must be string literals.
+class ScopedTimer {
+public:
+  ScopedTimer(Timings *timings, const char *phase) :
+      timings_(timings), phase_(phase) {
+    if (timings_ != nullptr) {
+      wall_start_ = std::chrono::steady_clock::now();
+      cpu_start_ = threadCpuTime();
+    }
+  }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  ~ScopedTimer() { stop(); }
+
+  // Ends the measurement before the timer goes out of scope.
+  void stop() {
+    if (timings_ != nullptr) {
+      std::chrono::duration<double> wall =
+          std::chrono::steady_clock::now() - wall_start_;
+      timings_->add(phase_, wall.count(), threadCpuTime() - cpu_start_);
+      timings_ = nullptr;
+    }
+  }
+
+private:
+  Timings *timings_;
+  const char *phase_;
+  std::chrono::steady_clock::time_point wall_start_;
+  double cpu_start_ = 0.0;
+};
+
+// Number and total size of the heap allocations made through operator new
+// since the program started.
+std::atomic<uint64_t> allocation_count(0);
+std::atomic<uint64_t> allocated_bytes(0);
+
+// Returns the peak resident set size of the process in bytes, or 0 if it is
+// not known.
+uint64_t peakResidentSetSize() {
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+    return (uint64_t)usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+  }
+#endif
+  return 0;
+}
+
+// Counts of what a run produced, summed over all targets. Safe to update from
+// multiple threads.
+struct RunStats {
+  std::atomic<uint64_t> targets{0};
+  std::atomic<uint64_t> types_emitted{0};
+  std::atomic<uint64_t> groups_emitted{0};
+  std::atomic<uint64_t> enums_emitted{0};
+  std::atomic<uint64_t> commands_emitted{0};
+  std::atomic<uint64_t> header_bytes{0};
+  std::atomic<uint64_t> source_bytes{0};
+};
+
+// Entities making up each version of an API profile.
+struct FeatureLevels {
+  // Version numbers, in increasing order.
+  std::vector<ApiVersion> versions;
+
+  // entities[i] holds the result of applying all features up to and
+  // including versions[i].
+  std::vector<EntityBitsets> entities;
+};
+
+// Definitions of all entities for one API, indexed by entity ID, so that
+// generating a target does not need to look entities up by name. An entry is
+// null if the entity has no definition for the API, if its ID was assigned
+// after the view was built, or, for lazily loaded commands, if the command has
+// not been parsed yet. The fallback for null entries is to look the entity up
+// by name.
+struct ApiView {
+  std::vector<const TypeInfo*> types;
+  std::vector<const EnumerantInfo*> enums;
+  std::vector<const CommandInfo*> commands;
+
+  // Groups with `enums` filled in for the API. Null if the group refers to
+  // an enumerant that is not defined for the API.
+  std::vector<const GroupInfo*> groups;
+  std::deque<GroupInfo> resolved_groups;
+};
+
+// Everything Galogen needs to know about the contents of a registry file.
+// Once a registry is loaded, the XML document is no longer needed.
+struct Registry {
+  Registry() = default;
+  Registry(const Registry&) = delete;
+  Registry& operator=(const Registry&) = delete;
+  Registry(Registry&&) = default;
+  Registry& operator=(Registry&&) = default;
+
+  // Storage for all strings referenced by the registry contents.
+  SymbolTable symbols;
+
+  EntityMap<TypeInfo> types;
+  EntityMap<EnumerantInfo> enums;
+  EntityMap<CommandInfo> commands;
+  EntityMap<GroupInfo> groups;
+  std::vector<FeatureInfo> features;
+  std::vector<ExtensionInfo> extensions;
+
+  // Names of all APIs mentioned by extensions. An API's index in this list
+  // is the number of the bit that represents it in ExtensionInfo's
+  // supported_apis mask.
+  std::vector<std::string> api_names;
+
+  // Location of an element in the registry file.
+  struct SourceRange {
+    size_t begin;
+    size_t end;
+    int line;
+  };
+
+  // When commands are loaded lazily, `commands` initially holds an empty
+  // entry for every command name, and the XML of each command stays in
+  // `source` until the command is first looked up with findCommand().
+  std::unique_ptr<MappedFile> source;
+  std::unordered_map<Symbol, std::vector<SourceRange>, SymbolHash>
+      unparsed_commands;
+
+  // When the registry is loaded from a snapshot, the strings of `symbols`
+  // are adopted from the mapped snapshot file, which has to stay mapped.
+  std::unique_ptr<MappedFile> snapshot;
+
+  // Dense IDs of all entities that are defined or referenced by the
+  // registry. Defined entities are numbered in registry order.
+  PerEntityKind<EntityIds> entity_ids;
+
+  // Entities added or removed by each <require> and <remove> element,
+  // compiled on first use for each API (see compileOperation()).
+  std::unordered_map<
+      Symbol,
+      std::unordered_map<const OperationInfo*, EntityBitsets>,
+      SymbolHash> compiled_operations;
+
+  // Cumulative entity sets after each version of an API, by API name and
+  // profile (see findFeatureLevels()).
+  std::unordered_map<
+      Symbol,
+      std::unordered_map<Symbol, FeatureLevels, SymbolHash>,
+      SymbolHash> feature_levels;
+
+  // Views of the entities of each API, by API name (see findApiView()).
+  std::unordered_map<Symbol, ApiView, SymbolHash> api_views;
+
+  // Guards `entity_ids`, `compiled_operations`, `feature_levels` and
+  // `api_views`. In registries that have a `source`, also guards parsing of
+  // lazily loaded commands, and with it `symbols`.
+  std::unique_ptr<std::mutex> mutex =
+      std::unique_ptr<std::mutex>(new std::mutex());
+};
+
+// Returns the bit representing the given API in the registry's API masks, or
+// 0 if no extension mentions the API.
+uint64_t findApiBit(const Registry &registry, const std::string &api_name) {
+  for (size_t i = 0; i < registry.api_names.size(); ++i) {
+    if (registry.api_names[i] == api_name) {
+      return 1ull << i;
+    }
+  }
+  return 0;
+}
+
+// Computes data derived from the registry contents. Must be called once the
+// registry has been fully loaded. Returns false and sets `*error` if the
+// registry can not be used.
+bool finishRegistry(Registry *registry, std::string *error) {
+  // Entities may be referenced without being defined.
+  for (const FeatureInfo &feature : registry->features) {
+    for (const OperationInfo &operation : feature.operations) {
+      for (const OperationInfo::EntityRef &entity_ref : operation.entities) {
+        registry->entity_ids[entity_ref.kind].get(entity_ref.name);
+      }
+    }
+  }
+  for (const ExtensionInfo &extension : registry->extensions) {
+    for (const OperationInfo &operation : extension.operations) {
+      for (const OperationInfo::EntityRef &entity_ref : operation.entities) {
+        registry->entity_ids[entity_ref.kind].get(entity_ref.name);
+      }
+    }
+  }
+  for (ExtensionInfo &extension : registry->extensions) {
+    extension.supported_apis = 0;
+    const std::string supported = extension.supported.str();
+    size_t begin = 0;
+    while (begin <= supported.size()) {
+      size_t end = supported.find('|', begin);
+      if (end == std::string::npos) {
+        end = supported.size();
+      }
+      std::string api_name = supported.substr(begin, end - begin);
+      uint64_t api_bit = findApiBit(*registry, api_name);
+      if (api_bit == 0) {
+        if (registry->api_names.size() >= 64) {
+          *error = "Too many distinct API names in registry";
+          return false;
+        }
+        api_bit = 1ull << registry->api_names.size();
+        registry->api_names.push_back(api_name);
+      }
+      extension.supported_apis |= api_bit;
+      begin = end + 1;
+    }
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// Registry loading.
+//
+// The registry is built in a single pass from a stream of XML events (element
+// start, text, element end), so no part of the document needs to be kept
+// around once its events have been consumed. Events come either from
+// XmlScanner, which reads the file directly without building a document tree,
+// or from DomEventSource, which walks a document parsed by tinyxml2.
+
+// An attribute of an XML element. Both strings are NUL-terminated and have
+// character references already expanded.
+struct XmlAttribute {
+  const char *name;
+  const char *value;
+};
+
+const char* findAttribute(const XmlAttribute *attributes,
+                          size_t attribute_count,
+                          const char *name) {
+  for (size_t i = 0; i < attribute_count; ++i) {
+    if (strcmp(attributes[i].name, name) == 0) {
+      return attributes[i].value;
+    }
+  }
+  return nullptr;
+}
+
+// Turns XML events into registry contents.
+class RegistryBuilder {
+public:
+  explicit RegistryBuilder(Registry *registry) :
+    registry_(registry), symbols_(registry->symbols) {}
+
+  // Makes the builder defer <command> elements: instead of being parsed, they
+  // are recorded in registry->unparsed_commands. `source` is the start of the
+  // registry file contents, which must be kept in registry->source.
+  void deferCommands(const char *source) { deferred_source_ = source; }
+
+  // Sets up the builder to parse a fragment of the registry file consisting
+  // of <command> elements, e.g. the source of a deferred command.
+  void startInCommands() { contexts_.push_back(Context::kCommands); }
+
+  // The first problem found in the registry contents, if any. Once a problem
+  // has been found, all further events are ignored.
+  const std::string& error() const { return error_; }
+  bool failed() const { return !error_.empty(); }
+
+  // Returns true if the contents of the element that was just started should
+  // not be reported. The event source must then call deferredElement() with
+  // the extent of the whole element, followed by endElement().
+  bool deferElement() {
+    bool defer = defer_element_;
+    defer_element_ = false;
+    return defer;
+  }
+
+  void deferredElement(const char *begin, const char *end, int line) {
+    if (failed()) {
+      return;
+    }
+    // Only the name of the command is needed now. Per the registry schema,
+    // <proto> is the first child of <command>, so the first <name> belongs to
+    // it.
+    static const char kNameTag[] = "<name>";
+    const size_t kNameTagLength = sizeof(kNameTag) - 1;
+    const char *name = begin;
+    while ((name = (const char*)memchr(name, '<', end - name)) != nullptr &&
+           ((size_t)(end - name) < kNameTagLength ||
+            memcmp(name, kNameTag, kNameTagLength) != 0)) {
+      ++name;
+    }
+    const char *name_end = end;
+    if (name == nullptr) {
+      name = end;
+    } else {
+      name += kNameTagLength;
+      name_end = (const char*)memchr(name, '<', end - name);
+      if (name_end == nullptr) {
+        name_end = end;
+      }
+    }
+    if (name == end || name == name_end) {
+      error_ = formatMessage("Command missing name on line %d", line);
+      return;
+    }
+    Symbol command_name = symbols_.intern(name, name_end - name);
+    registry_->commands[command_name];
+    registry_->entity_ids[EntityKind::kCommand].get(command_name);
+    Registry::SourceRange range;
+    range.begin = begin - deferred_source_;
+    range.end = end - deferred_source_;
+    range.line = line;
+    registry_->unparsed_commands[command_name].push_back(range);
+    command_deferred_ = true;
+  }
+
+  void startElement(const char *tag,
+                    const XmlAttribute *attributes,
+                    size_t attribute_count,
+                    int line) {
+    if (failed()) {
+      return;
+    }
+    auto attribute = [&](const char *name) {
+      return findAttribute(attributes, attribute_count, name);
+    };
+    auto symbol_attribute = [&](const char *name) {
+      const char *value = attribute(name);
+      return value != nullptr ? symbols_.intern(value) : Symbol();
+    };
+    Context parent = contexts_.empty() ? Context::kDocument : contexts_.back();
+    Context context = Context::kIgnored;
+    switch (parent) {
+    case Context::kDocument:
+      context = Context::kRegistry;
+      break;
+    case Context::kRegistry:
+      if (strcmp(tag, "types") == 0) {
+        context = Context::kTypes;
+      } else if (strcmp(tag, "enums") == 0) {
+        context = Context::kEnums;
+      } else if (strcmp(tag, "commands") == 0) {
+        context = Context::kCommands;
+      } else if (strcmp(tag, "groups") == 0) {
+        context = Context::kGroups;
+      } else if (strcmp(tag, "extensions") == 0) {
+        context = Context::kExtensions;
+      } else if (strcmp(tag, "feature") == 0) {
+        if (attribute("api") == nullptr) {
+          error_ = formatMessage("Feature tag missing api attribute on line %d",
+                                 line);
+          return;
+        }
+        feature_ = FeatureInfo();
+        feature_.api = symbol_attribute("api");
+        feature_.name = symbol_attribute("name");
+        feature_.number = symbol_attribute("number");
+        operations_ = &feature_.operations;
+        context = Context::kFeature;
+      }
+      break;
+    case Context::kTypes:
+      if (strcmp(tag, "type") == 0) {
+        type_ = TypeInfo();
+        type_line_ = line;
+        type_.name = symbol_attribute("name");
+        type_.prerequisite_type = symbol_attribute("requires");
+        type_.api = symbol_attribute("api");
+        type_cdecl_.clear();
+        context = Context::kType;
+      }
+      break;
+    case Context::kType:
+      if (strcmp(tag, "name") == 0) {
+        element_text_.clear();
+        context = Context::kTypeName;
+      } else if (strcmp(tag, "apientry") == 0) {
+        type_cdecl_ += " GL_APIENTRY ";
+      } else {
+        error_ = formatMessage(
+            "Unexpected element \"%s\" in type definition on line %d",
+            tag,
+            type_line_);
+        return;
+      }
+      break;
+    case Context::kEnums:
+      if (strcmp(tag, "enum") == 0) {
+        enum_ = EnumerantInfo();
+        enum_.name = symbol_attribute("name");
+        enum_.value = symbol_attribute("value");
+        if (enum_.name.empty() || enum_.value.empty()) {
+          error_ = formatMessage(
+              "Enumerant missing \"name\" or \"value\" attribute on line %d",
+              line);
+          return;
+        }
+        enum_.suffix = symbol_attribute("type");
+        enum_.alias = symbol_attribute("alias");
+        enum_.api = symbol_attribute("api");
+        context = Context::kEnum;
+      }
+      break;
+    case Context::kCommands:
+      if (strcmp(tag, "command") == 0) {
+        command_ = CommandInfo();
+        prototype_.clear();
+        return_ctype_.clear();
+        seen_proto_ = seen_alias_ = seen_vecequiv_ = false;
+        defer_element_ = deferred_source_ != nullptr;
+        command_deferred_ = false;
+        context = Context::kCommand;
+      }
+      break;
+    case Context::kCommand:
+      if (strcmp(tag, "proto") == 0 && !seen_proto_) {
+        seen_proto_ = true;
+        context = Context::kProto;
+      } else if (strcmp(tag, "param") == 0) {
+        command_.parameters.emplace_back();
+        CommandInfo::ParamInfo &param = command_.parameters.back();
+        param.group = symbol_attribute("group");
+        param.len = symbol_attribute("len");
+        param_ctype_.clear();
+        context = Context::kParam;
+      } else if (strcmp(tag, "alias") == 0 && !seen_alias_) {
+        seen_alias_ = true;
+        command_.alias = symbol_attribute("name");
+      } else if (strcmp(tag, "vecequiv") == 0 && !seen_vecequiv_) {
+        seen_vecequiv_ = true;
+        command_.vecequiv = symbol_attribute("name");
+      }
+      break;
+    case Context::kProto:
+    case Context::kParam: {
+      bool in_proto = parent == Context::kProto;
+      if (strcmp(tag, "ptype") == 0) {
+        context = in_proto ? Context::kProtoPtype : Context::kParamPtype;
+      } else if (strcmp(tag, "name") == 0) {
+        context = in_proto ? Context::kProtoName : Context::kParamName;
+      } else {
+        error_ = formatMessage("Unknown tag \"%s\" on line %d", tag, line);
+        return;
+      }
+      element_text_.clear();
+      break;
+    }
+    case Context::kGroups:
+      if (strcmp(tag, "group") == 0) {
+        group_ = GroupInfo();
+        group_.name = symbol_attribute("name");
+        if (group_.name.empty()) {
+          error_ = formatMessage("Group missing \"name\" attribute on line %d",
+                                 line);
+          return;
+        }
+        context = Context::kGroup;
+      }
+      break;
+    case Context::kGroup:
+      if (strcmp(tag, "enum") == 0) {
+        if (attribute("name") == nullptr) {
+          error_ = formatMessage(
+              "Enum reference missing name attribute on line %d",
+              line);
+          return;
+        }
+        group_.enum_names.push_back(symbol_attribute("name"));
+      }
+      break;
+    case Context::kExtensions:
+      if (strcmp(tag, "extension") == 0) {
+        extension_ = ExtensionInfo();
+        extension_.name = symbol_attribute("name");
+        extension_.supported = symbol_attribute("supported");
+        if (extension_.name.empty() || extension_.supported.empty()) {
+          error_ = formatMessage(
+              "Extension missing \"%s\" attribute on line %d",
+              extension_.name.empty() ? "name" : "supported",
+              line);
+          return;
+        }
+        operations_ = &extension_.operations;
+        context = Context::kExtension;
+      }
+      break;
+    case Context::kFeature:
+    case Context::kExtension: {
+      operations_->emplace_back();
+      OperationInfo &operation = operations_->back();
+      operation.require = strcmp(tag, "require") == 0;
+      operation.profile = symbol_attribute("profile");
+      context = Context::kOperation;
+      break;
+    }
+    case Context::kOperation: {
+      OperationInfo::EntityRef ref;
+      ref.kind = entityKindFromTag(tag);
+      ref.name = symbol_attribute("name");
+      if (ref.name.empty()) {
+        error_ = formatMessage("%s missing name attribute on line %d",
+                               tag,
+                               line);
+        return;
+      }
+      operations_->back().entities.push_back(ref);
+      break;
+    }
+    default:
+      break;
+    }
+    contexts_.push_back(context);
+  }
+
+  void text(const char *text, size_t length) {
+    if (failed() || contexts_.empty()) {
+      return;
+    }
+    switch (contexts_.back()) {
+    case Context::kType:
+      type_cdecl_.append(text, length);
+      break;
+    case Context::kProto:
+      return_ctype_ += ' ';
+      return_ctype_.append(text, length);
+      prototype_.append(text, length);
+      trimReturnCtype();
+      break;
+    case Context::kParam:
+      param_ctype_.append(text, length);
+      break;
+    case Context::kTypeName:
+    case Context::kProtoPtype:
+    case Context::kProtoName:
+    case Context::kParamPtype:
+    case Context::kParamName:
+      element_text_.append(text, length);
+      break;
+    default:
+      break;
+    }
+  }
+
+  void endElement() {
+    if (failed()) {
+      return;
+    }
+    Context context = contexts_.back();
+    contexts_.pop_back();
+    switch (context) {
+    case Context::kType:
+      if (type_.name.empty()) {
+        error_ = formatMessage("Type missing \"name\" attribute on line %d",
+                               type_line_);
+        return;
+      }
+      type_.type_cdecl = symbols_.intern(type_cdecl_);
+      registry_->entity_ids[EntityKind::kType].get(type_.name);
+      registry_->types[type_.name].add(std::move(type_));
+      break;
+    case Context::kTypeName:
+      type_.name = symbols_.intern(element_text_);
+      type_cdecl_ += ' ';
+      type_cdecl_ += element_text_;
+      break;
+    case Context::kEnum:
+      registry_->entity_ids[EntityKind::kEnum].get(enum_.name);
+      registry_->enums[enum_.name].add(std::move(enum_));
+      break;
+    case Context::kCommand:
+      if (!command_deferred_) {
+        command_.prototype = symbols_.intern(prototype_);
+        command_.return_ctype = symbols_.intern(return_ctype_);
+        registry_->entity_ids[EntityKind::kCommand].get(command_.name);
+        registry_->commands[command_.name].add(std::move(command_));
+      }
+      break;
+    case Context::kProtoPtype:
+      return_ctype_ += ' ';
+      return_ctype_ += element_text_;
+      command_.referenced_api_type = symbols_.intern(element_text_);
+      prototype_ += element_text_;
+      trimReturnCtype();
+      break;
+    case Context::kProtoName:
+      command_.name = symbols_.intern(element_text_);
+      prototype_ += element_text_;
+      break;
+    case Context::kParam:
+      command_.parameters.back().ctype = symbols_.intern(param_ctype_);
+      break;
+    case Context::kParamPtype:
+      command_.parameters.back().referenced_api_type =
+          symbols_.intern(element_text_);
+      param_ctype_ += element_text_;
+      break;
+    case Context::kParamName:
+      command_.parameters.back().name = symbols_.intern(element_text_);
+      break;
+    case Context::kGroup:
+      registry_->entity_ids[EntityKind::kGroup].get(group_.name);
+      registry_->groups[group_.name].add(std::move(group_));
+      break;
+    case Context::kFeature:
+      registry_->features.emplace_back(std::move(feature_));
+      break;
+    case Context::kExtension:
+      registry_->extensions.emplace_back(std::move(extension_));
+      break;
+    default:
+      break;
+    }
+  }
+
+private:
+  // Clean up return ctype. Done after each child of <proto>, so that
+  // whitespace at the end of a text node doesn't pile up with the space
+  // inserted before the next one.
+  void trimReturnCtype() {
+    std::string &return_ctype = return_ctype_;
+    auto l = [](int c) { return !isspace(c); };
+    return_ctype.erase(return_ctype.begin(),
+                       std::find_if(return_ctype.begin(),
+                                    return_ctype.end(),
+                                    l));
+    return_ctype.erase(std::find_if(return_ctype.rbegin(),
+                                    return_ctype.rend(),
+                                    l).base(), return_ctype.end());
+  }
+
+  // Which part of the registry an open element describes.
+  enum class Context {
+    kDocument,
+    kIgnored,
+    kRegistry,
+    kTypes,
+    kType,
+    kTypeName,
+    kEnums,
+    kEnum,
+    kCommands,
+    kCommand,
+    kProto,
+    kProtoPtype,
+    kProtoName,
+    kParam,
+    kParamPtype,
+    kParamName,
+    kGroups,
+    kGroup,
+    kFeature,
+    kExtensions,
+    kExtension,
+    kOperation
+  };
+
+  Registry *registry_;
+  SymbolTable &symbols_;
+  std::vector<Context> contexts_;
+
+  // Entities currently under construction.
+  TypeInfo type_;
+  int type_line_ = 0;
+  EnumerantInfo enum_;
+  CommandInfo command_;
+  bool seen_proto_ = false;
+  bool seen_alias_ = false;
+  bool seen_vecequiv_ = false;
+  bool command_deferred_ = false;
+  GroupInfo group_;
+  FeatureInfo feature_;
+  ExtensionInfo extension_;
+  std::vector<OperationInfo> *operations_ = nullptr;
+
+  // C code being assembled for the entity under construction. Interned once
+  // the corresponding element ends.
+  std::string type_cdecl_;
+  std::string prototype_;
+  std::string return_ctype_;
+  std::string param_ctype_;
+
+  // Text content of the innermost <name> or <ptype> element.
+  std::string element_text_;
+
+  // Set if commands are deferred; points to the start of the registry file.
+  const char *deferred_source_ = nullptr;
+  bool defer_element_ = false;
+
+  std::string error_;
+};
+
+// Appends the UTF-8 encoding of a Unicode code point to `out`.
+void appendUtf8(unsigned long code_point, std::string *out) {
+  if (code_point < 0x80) {
+    out->push_back((char)code_point);
+  } else if (code_point < 0x800) {
+    out->push_back((char)(0xC0 | (code_point >> 6)));
+    out->push_back((char)(0x80 | (code_point & 0x3F)));
+  } else if (code_point < 0x10000) {
+    out->push_back((char)(0xE0 | (code_point >> 12)));
+    out->push_back((char)(0x80 | ((code_point >> 6) & 0x3F)));
+    out->push_back((char)(0x80 | (code_point & 0x3F)));
+  } else {
+    out->push_back((char)(0xF0 | (code_point >> 18)));
+    out->push_back((char)(0x80 | ((code_point >> 12) & 0x3F)));
+    out->push_back((char)(0x80 | ((code_point >> 6) & 0x3F)));
+    out->push_back((char)(0x80 | (code_point & 0x3F)));
+  }
+}
+
+// Returns the first byte in [begin, end) that is equal to `a`, `b` or `c`, or
+// `end` if there is none. Pass the same character more than once to search
+// for fewer characters.
+const char* findAnyOfScalar(const char *begin,
+                            const char *end,
+                            char a,
+                            char b,
+                            char c) {
+  const char *p = begin;
+  while (p < end && *p != a && *p != b && *p != c) { ++p; }
+  return p;
+}
+
+// Returns the number of bytes in [begin, end) that are equal to `c`.
+size_t countByteScalar(const char *begin, const char *end, char c) {
+  return (size_t)std::count(begin, end, c);
+}
+
+#if defined(GALOGEN_HAS_SSE2)
+
+// Returns the index of the lowest set bit of `mask`, which must not be 0.
+unsigned lowestSetBit(unsigned mask) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (unsigned)index;
+#else
+  return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+// Same as findAnyOfScalar(), but compares 16 bytes at a time.
+const char* findAnyOf(const char *begin,
+                      const char *end,
+                      char a,
+                      char b,
+                      char c) {
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  const __m128i vc = _mm_set1_epi8(c);
+  const char *p = begin;
+  for (; end - p >= 16; p += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)p);
+    __m128i matches = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(bytes, va), _mm_cmpeq_epi8(bytes, vb)),
+        _mm_cmpeq_epi8(bytes, vc));
+    int mask = _mm_movemask_epi8(matches);
+    if (mask != 0) {
+      return p + lowestSetBit((unsigned)mask);
+    }
+  }
+  return findAnyOfScalar(p, end, a, b, c);
+}
+
+// Same as countByteScalar(), but compares 16 bytes at a time.
+size_t countByte(const char *begin, const char *end, char c) {
+  const __m128i vc = _mm_set1_epi8(c);
+  const char *p = begin;
+  size_t result = 0;
+  while (end - p >= 16) {
+    // Matches are subtracted (as -1) from per-lane counters, which are summed
+    // before they can overflow.
+    __m128i counters = _mm_setzero_si128();
+    const char *block_end =
+        p + std::min((size_t)(end - p) / 16, (size_t)255) * 16;
+    for (; p < block_end; p += 16) {
+      __m128i bytes = _mm_loadu_si128((const __m128i*)p);
+      counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(bytes, vc));
+    }
+    __m128i sums = _mm_sad_epu8(counters, _mm_setzero_si128());
+    result += (size_t)_mm_cvtsi128_si32(sums) +
+              (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+  }
+  return result + countByteScalar(p, end, c);
+}
+
+#else
+
+const char* findAnyOf(const char *begin,
+                      const char *end,
+                      char a,
+                      char b,
+                      char c) {
+  return findAnyOfScalar(begin, end, a, b, c);
+}
+
+size_t countByte(const char *begin, const char *end, char c) {
+  return countByteScalar(begin, end, c);
+}
+
+#endif
+
+// A part of the registry file consisting of complete elements, which can be
+// scanned independently of the rest: either a sequence of children of the
+// root element, or, if `section` is not empty, a sequence of children of a
+// section element such as <commands>.
+struct XmlChunk {
+  const char *begin;
+  const char *end;
+  int line;
+  std::string section;
+};
+
+// Minimal non-validating XML reader. Understands elements, attributes, text,
+// comments, CDATA sections, processing instructions and DOCTYPE declarations
+// without an internal subset. Expands predefined and numeric character
+// references, normalizes line endings and, like tinyxml2, drops text that
+// consists only of whitespace.
+class XmlScanner {
+public:
+  XmlScanner(const char *data, size_t size, int first_line = 1) :
+    p_(data), end_(data + size), line_(first_line), line_end_(data) {}
+
+  // Feeds the whole input to `builder`. Returns false and sets `*error` if the
+  // input is not well-formed or the builder rejects its contents.
+  bool scan(RegistryBuilder *builder, std::string *error) {
+    while (p_ < end_ && !builder->failed()) {
+      if (*p_ != '<') {
+        scanText(builder);
+      } else if (startsWith("<!--")) {
+        skipPast("-->");
+      } else if (startsWith("<![CDATA[")) {
+        const char *cdata = p_ + 9;
+        if (!skipPast("]]>")) {
+          break;
+        }
+        decoded_.clear();
+        appendNormalized(cdata, p_ - 3, &decoded_);
+        builder->text(decoded_.data(), decoded_.size());
+      } else if (startsWith("<?")) {
+        skipPast("?>");
+      } else if (startsWith("<!")) {
+        skipPast(">");
+      } else if (startsWith("</")) {
+        scanEndTag(builder);
+      } else {
+        scanStartTag(builder);
+      }
+    }
+    if (error_.empty() && builder->failed()) {
+      error_ = builder->error();
+    }
+    if (error_.empty() && !open_tags_.empty()) {
+      error_ = formatMessage(
+          "XML syntax error: unexpected end of file, element \"%s\" is not"
+          " closed",
+          std::string(open_tags_.back().first,
+                      open_tags_.back().second).c_str());
+    }
+    *error = error_;
+    return error_.empty();
+  }
+
+  // Splits the input, which must be a whole registry, into chunks of about
+  // `chunk_size` bytes in document order. Children of the root element are
+  // kept whole, except for sections listed in `sections` as pairs of section
+  // and child tag, e.g. ("commands", "command"), which are split between
+  // their children if they are bigger than one chunk.
+  //
+  // Only the root element's tags are checked; the chunks must be scanned to
+  // find other errors. Elements are found by searching for their end tags,
+  // so children of the root and children of split sections must not contain
+  // elements with the same name, and their end tags must not appear in
+  // comments or CDATA sections. Returns false and sets `*error` if the input
+  // is not well-formed.
+  bool split(size_t chunk_size,
+             const std::vector<std::pair<std::string, std::string>> &sections,
+             std::vector<XmlChunk> *chunks,
+             std::string *error) {
+    std::pair<const char*, size_t> root;
+    bool root_empty = false;
+    if (!skipMarkup() || p_ >= end_ || startsWith("</") ||
+        !skipStartTag(&root, &root_empty)) {
+      fail("missing root element");
+      *error = error_;
+      return false;
+    }
+    // Children of the root element not yet added to `chunks`.
+    XmlChunk pending = {nullptr, nullptr, 0, std::string()};
+    auto flush = [&]() {
+      if (pending.begin != nullptr) {
+        chunks->push_back(pending);
+        pending.begin = nullptr;
+      }
+    };
+    bool seen_root_end = root_empty;
+    while (!seen_root_end && skipMarkup()) {
+      if (p_ >= end_) {
+        fail("unexpected end of file");
+        break;
+      }
+      if (startsWith("</")) {
+        seen_root_end = skipEndTag(root);
+        break;
+      }
+      const char *element = p_;
+      int line = currentLine();
+      std::pair<const char*, size_t> tag;
+      bool empty = false;
+      if (!skipStartTag(&tag, &empty)) {
+        break;
+      }
+      std::vector<XmlChunk> section_chunks;
+      if (!empty) {
+        std::string tag_name(tag.first, tag.second);
+        const char *content = p_;
+        int content_line = currentLine();
+        const char *content_end = findEndTag(p_, tag_name);
+        if (content_end == end_) {
+          fail("element \"" + tag_name + "\" is not closed", line);
+          break;
+        }
+        p_ = content_end;
+        if (!skipEndTag(tag)) {
+          break;
+        }
+        for (const auto &section : sections) {
+          if (section.first == tag_name &&
+              (size_t)(p_ - element) > chunk_size) {
+            splitSection(content, content_end, content_line, chunk_size,
+                         section.first, section.second, &section_chunks);
+          }
+        }
+      }
+      if (section_chunks.size() > 1) {
+        flush();
+        chunks->insert(chunks->end(),
+                       section_chunks.begin(),
+                       section_chunks.end());
+        continue;
+      }
+      if (pending.begin == nullptr) {
+        pending.begin = element;
+        pending.line = line;
+      }
+      pending.end = p_;
+      if ((size_t)(pending.end - pending.begin) >= chunk_size) {
+        flush();
+      }
+    }
+    if (seen_root_end && skipMarkup() && p_ < end_) {
+      fail("content after the root element");
+    }
+    flush();
+    *error = error_;
+    return error_.empty();
+  }
+
+private:
+  // Splits the contents of a section, [begin, end), after the end tags of
+  // children with the given tag.
+  void splitSection(const char *begin,
+                    const char *end,
+                    int line,
+                    size_t chunk_size,
+                    const std::string &section,
+                    const std::string &child,
+                    std::vector<XmlChunk> *chunks) const {
+    XmlChunk chunk = {begin, end, line, section};
+    while ((size_t)(end - chunk.begin) > chunk_size) {
+      const char *child_end = findEndTag(chunk.begin + chunk_size, child);
+      if (child_end >= end) {
+        break;
+      }
+      const char *boundary = (const char*)memchr(child_end, '>', end - child_end);
+      if (boundary == nullptr) {
+        break;
+      }
+      chunk.end = boundary + 1;
+      chunks->push_back(chunk);
+      chunk.line += (int)countByte(chunk.begin, chunk.end, '\n');
+      chunk.begin = chunk.end;
+      chunk.end = end;
+    }
+    chunks->push_back(chunk);
+  }
+
+  // Returns the first end tag with the given name at or after `from`, or end_
+  // if there is none.
+  const char* findEndTag(const char *from, const std::string &name) const {
+    const char *p = from;
+    while (p < end_) {
+      p = (const char*)memchr(p, '<', end_ - p);
+      if (p == nullptr) {
+        break;
+      }
+      if ((size_t)(end_ - p) > name.size() + 2 &&
+          p[1] == '/' &&
+          memcmp(p + 2, name.data(), name.size()) == 0 &&
+          isNameEnd(p[2 + name.size()])) {
+        return p;
+      }
+      ++p;
+    }
+    return end_;
+  }
+
+  // Skips text, comments, CDATA sections, processing instructions and DOCTYPE
+  // declarations, up to the next start or end tag or the end of the input.
+  // Returns false on syntax errors.
+  bool skipMarkup() {
+    while (p_ < end_) {
+      const char *tag = (const char*)memchr(p_, '<', end_ - p_);
+      p_ = tag != nullptr ? tag : end_;
+      if (tag == nullptr) {
+        break;
+      }
+      bool skipped = true;
+      if (startsWith("<!--")) {
+        skipped = skipPast("-->");
+      } else if (startsWith("<![CDATA[")) {
+        skipped = skipPast("]]>");
+      } else if (startsWith("<?")) {
+        skipped = skipPast("?>");
+      } else if (startsWith("<!")) {
+        skipped = skipPast(">");
+      } else {
+        break;
+      }
+      if (!skipped) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Skips a start tag without decoding its attributes. Sets `*empty` if the
+  // tag is self-closing.
+  bool skipStartTag(std::pair<const char*, size_t> *tag, bool *empty) {
+    int line = currentLine();
+    ++p_;
+    if (!scanName(tag)) {
+      return false;
+    }
+    for (;;) {
+      p_ = findAnyOf(p_, end_, '>', '"', '\'');
+      if (p_ >= end_) {
+        return fail("unterminated tag", line);
+      }
+      if (*p_ == '>') {
+        *empty = p_[-1] == '/';
+        ++p_;
+        return true;
+      }
+      const char *value_end =
+          (const char*)memchr(p_ + 1, *p_, end_ - p_ - 1);
+      if (value_end == nullptr) {
+        return fail("unterminated attribute value");
+      }
+      p_ = value_end + 1;
+    }
+  }
+
+  // Skips the end tag of the given element.
+  bool skipEndTag(std::pair<const char*, size_t> tag) {
+    p_ += 2;
+    std::pair<const char*, size_t> name;
+    if (!scanName(&name)) {
+      return false;
+    }
+    if (name.second != tag.second ||
+        memcmp(name.first, tag.first, tag.second) != 0) {
+      return fail("mismatched closing tag \"" +
+                  std::string(name.first, name.second) + "\"");
+    }
+    skipWhitespace();
+    return expect('>');
+  }
+
+  static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  }
+
+  static bool isNameEnd(char c) {
+    return isSpace(c) || c == '/' || c == '>' || c == '=';
+  }
+
+  bool startsWith(const char *prefix) const {
+    size_t length = strlen(prefix);
+    return (size_t)(end_ - p_) >= length && memcmp(p_, prefix, length) == 0;
+  }
+
+  // Returns the line number at p_. Lines are counted on demand, which
+  // touches every byte once in long runs instead of once per token.
+  int currentLine() {
+    line_ += (int)countByte(line_end_, p_, '\n');
+    line_end_ = p_;
+    return line_;
+  }
+
+  // Records a syntax error on the given line, or the current line if 0, and
+  // stops scanning. Always returns false.
+  bool fail(const std::string &message, int line = 0) {
+    if (error_.empty()) {
+      error_ = "XML syntax error on line " +
+               std::to_string(line != 0 ? line : currentLine()) + ": " +
+               message;
+    }
+    p_ = end_;
+    return false;
+  }
+
+  bool skipPast(const char *terminator) {
+    size_t length = strlen(terminator);
+    for (const char *p = p_; p < end_; ++p) {
+      p = (const char*)memchr(p, terminator[0], end_ - p);
+      if (p == nullptr) {
+        break;
+      }
+      if ((size_t)(end_ - p) >= length && memcmp(p, terminator, length) == 0) {
+        p_ = p + length;
+        return true;
+      }
+    }
+    return fail("missing \"" + std::string(terminator) + "\"");
+  }
+
+  void skipWhitespace() {
+    const char *p = p_;
+    while (p < end_ && isSpace(*p)) { ++p; }
+    p_ = p;
+  }
+
+  bool expect(char c) {
+    if (p_ >= end_ || *p_ != c) {
+      return fail(std::string("expected '") + c + "'");
+    }
+    ++p_;
+    return true;
+  }
+
+  bool scanName(std::pair<const char*, size_t> *name) {
+    const char *begin = p_;
+    while (p_ < end_ && !isNameEnd(*p_)) { ++p_; }
+    if (p_ == begin) {
+      return fail("expected a name");
+    }
+    *name = std::make_pair(begin, (size_t)(p_ - begin));
+    return true;
+  }
+
+  // Appends [begin, end) to out, converting CR LF and lone CR to LF.
+  static void appendNormalized(const char *begin, const char *end,
+                               std::string *out) {
+    const char *p = begin;
+    while (p < end) {
+      const char *cr = (const char*)memchr(p, '\r', end - p);
+      if (cr == nullptr) {
+        out->append(p, end);
+        break;
+      }
+      out->append(p, cr);
+      out->push_back('\n');
+      p = cr + 1;
+      if (p < end && *p == '\n') { ++p; }
+    }
+  }
+
+  // Appends [begin, end) to out, expanding character references. Unknown
+  // references are copied verbatim.
+  static void appendDecoded(const char *begin, const char *end,
+                            std::string *out) {
+    static const struct { const char *name; char value; } kEntities[] = {
+      {"lt;", '<'}, {"gt;", '>'}, {"amp;", '&'}, {"quot;", '"'},
+      {"apos;", '\''}
+    };
+    const char *p = begin;
+    while (p < end) {
+      const char *special = findAnyOf(p, end, '&', '\r', '\r');
+      out->append(p, special);
+      if (special == end) {
+        break;
+      }
+      p = special + 1;
+      if (*special == '\r') {
+        out->push_back('\n');
+        if (p < end && *p == '\n') { ++p; }
+        continue;
+      }
+      bool expanded = false;
+      if (p < end && *p == '#') {
+        const char *digits = p + 1;
+        int base = 10;
+        if (digits < end && (*digits == 'x' || *digits == 'X')) {
+          base = 16;
+          ++digits;
+        }
+        const char *semicolon =
+            (const char*)memchr(digits, ';', end - digits);
+        if (semicolon != nullptr && semicolon > digits) {
+          std::string number(digits, semicolon);
+          char *number_end = nullptr;
+          unsigned long code_point = strtoul(number.c_str(), &number_end, base);
+          if (*number_end == '\0' && code_point <= 0x10FFFF) {
+            appendUtf8(code_point, out);
+            p = semicolon + 1;
+            expanded = true;
+          }
+        }
+      } else {
+        for (const auto &entity : kEntities) {
+          size_t length = strlen(entity.name);
+          if ((size_t)(end - p) >= length &&
+              memcmp(p, entity.name, length) == 0) {
+            out->push_back(entity.value);
+            p += length;
+            expanded = true;
+            break;
+          }
+        }
+      }
+      if (!expanded) {
+        out->push_back('&');
+      }
+    }
+  }
+
+  void scanText(RegistryBuilder *builder) {
+    const char *text_end = (const char*)memchr(p_, '<', end_ - p_);
+    if (text_end == nullptr) {
+      text_end = end_;
+    }
+    const char *text = p_;
+    p_ = text_end;
+    if (std::all_of(text, text_end, isSpace) || open_tags_.empty()) {
+      return;
+    }
+    decoded_.clear();
+    appendDecoded(text, text_end, &decoded_);
+    builder->text(decoded_.data(), decoded_.size());
+  }
+
+  void scanStartTag(RegistryBuilder *builder) {
+    int line = currentLine();
+    const char *element = p_;
+    ++p_;
+    std::pair<const char*, size_t> tag;
+    if (!scanName(&tag)) {
+      return;
+    }
+    size_t attribute_count = 0;
+    bool self_closing = false;
+    for (;;) {
+      skipWhitespace();
+      if (p_ >= end_) {
+        fail("unterminated tag", line);
+        return;
+      }
+      if (*p_ == '>') {
+        ++p_;
+        break;
+      }
+      if (*p_ == '/') {
+        ++p_;
+        if (!expect('>')) {
+          return;
+        }
+        self_closing = true;
+        break;
+      }
+      std::pair<const char*, size_t> name;
+      if (!scanName(&name)) {
+        return;
+      }
+      skipWhitespace();
+      if (!expect('=')) {
+        return;
+      }
+      skipWhitespace();
+      if (p_ >= end_ || (*p_ != '"' && *p_ != '\'')) {
+        fail("expected attribute value");
+        return;
+      }
+      char quote = *p_++;
+      const char *value_end = (const char*)memchr(p_, quote, end_ - p_);
+      if (value_end == nullptr) {
+        fail("unterminated attribute value");
+        return;
+      }
+      if (attribute_count == attribute_names_.size()) {
+        attribute_names_.emplace_back();
+        attribute_values_.emplace_back();
+      }
+      attribute_names_[attribute_count].assign(name.first, name.second);
+      std::string &value = attribute_values_[attribute_count];
+      value.clear();
+      appendDecoded(p_, value_end, &value);
+      ++attribute_count;
+      p_ = value_end + 1;
+    }
+    attributes_.resize(attribute_count);
+    for (size_t i = 0; i < attribute_count; ++i) {
+      attributes_[i].name = attribute_names_[i].c_str();
+      attributes_[i].value = attribute_values_[i].c_str();
+    }
+    tag_.assign(tag.first, tag.second);
+    builder->startElement(tag_.c_str(), attributes_.data(), attribute_count,
+                          line);
+    if (builder->deferElement() && !self_closing) {
+      // Skip to the end of the element. Deferred elements can not contain
+      // elements with the same name, so the first closing tag is the right
+      // one.
+      const char *element_end = findEndTag(p_, tag_);
+      if (element_end == end_) {
+        fail("element \"" + tag_ + "\" is not closed", line);
+        return;
+      }
+      p_ = element_end;
+      if (!skipEndTag(tag)) {
+        return;
+      }
+      builder->deferredElement(element, p_, line);
+      self_closing = true;
+    }
+    if (self_closing) {
+      builder->endElement();
+    } else {
+      open_tags_.push_back(tag);
+    }
+  }
+
+  void scanEndTag(RegistryBuilder *builder) {
+    p_ += 2;
+    std::pair<const char*, size_t> tag;
+    if (!scanName(&tag)) {
+      return;
+    }
+    if (open_tags_.empty() ||
+        open_tags_.back().second != tag.second ||
+        memcmp(open_tags_.back().first, tag.first, tag.second) != 0) {
+      fail("mismatched closing tag \"" +
+           std::string(tag.first, tag.second) + "\"");
+      return;
+    }
+    skipWhitespace();
+    if (!expect('>')) {
+      return;
+    }
+    open_tags_.pop_back();
+    builder->endElement();
+  }
+
+  const char *p_;
+  const char *end_;
+  std::string error_;
+
+  // Line number at line_end_, which is at or before p_.
+  int line_;
+  const char *line_end_;
+
+  // Names of the currently open elements, pointing into the input.
+  std::vector<std::pair<const char*, size_t>> open_tags_;
+
+  // Scratch storage, reused between elements to avoid allocations.
+  std::string tag_;
+  std::string decoded_;
+  std::vector<std::string> attribute_names_;
+  std::vector<std::string> attribute_values_;
+  std::vector<XmlAttribute> attributes_;
+};
+
+// Feeds the contents of a document parsed by tinyxml2 to a RegistryBuilder.
+class DomEventSource : public tinyxml2::XMLVisitor {
+public:
+  explicit DomEventSource(RegistryBuilder *builder) : builder_(builder) {}
+
+  bool VisitEnter(const tinyxml2::XMLElement &element,
+                  const tinyxml2::XMLAttribute *first_attribute) override {
+    attributes_.clear();
+    for (const tinyxml2::XMLAttribute *a = first_attribute;
+         a != nullptr;
+         a = a->Next()) {
+      XmlAttribute attribute;
+      attribute.name = a->Name();
+      attribute.value = a->Value();
+      attributes_.push_back(attribute);
+    }
+    builder_->startElement(element.Value(),
+                           attributes_.data(),
+                           attributes_.size(),
+                           element.GetLineNum());
+    return !builder_->failed();
+  }
+
+  bool VisitExit(const tinyxml2::XMLElement&) override {
+    builder_->endElement();
+    return !builder_->failed();
+  }
+
+  bool Visit(const tinyxml2::XMLText &text) override {
+    builder_->text(text.Value(), strlen(text.Value()));
+    return !builder_->failed();
+  }
+
+private:
+  RegistryBuilder *builder_;
+  std::vector<XmlAttribute> attributes_;
+};
+
+// XML parsers that can be used to read the registry.
+enum class XmlParser {
+  // Reads the registry in a single pass without building a document tree.
+  kStreaming,
+
+  // Builds a tinyxml2 document first. Slower and uses more memory, but
+  // performs more thorough well-formedness checks.
+  kTinyXml2,
+
+  // Like kStreaming, but splits the registry into chunks that are read by
+  // multiple threads (see scanParallel()).
+  kParallel
+};
+
+// Options controlling how the registry is loaded.
+struct RegistryLoadOptions {
+  std::string file_name;
+
+  // If not empty, the registry is cached in a snapshot file at this path.
+  std::string snapshot_file_name;
+
+  XmlParser parser = XmlParser::kStreaming;
+
+  // Only index <command> elements by name while loading, and parse each
+  // command when it is first looked up. Most targets use a small fraction of
+  // the commands in the registry. Only supported by the streaming parser, and
+  // ignored when a snapshot is written, since snapshots need every command.
+  bool lazy_commands = true;
+
+  // Number of threads used by the parallel parser. If 0, uses one thread per
+  // hardware thread. Does not affect the loaded registry.
+  unsigned jobs = 0;
+};
+
+// ----------------------------------------------------------------------------
+// Registry snapshots.
+//
+// Parsing the XML registry dominates Galogen's running time. A snapshot is a
+// compact binary dump of a loaded Registry which can be memory-mapped and
+// turned back into a Registry without touching the XML. Each snapshot records
+// a hash of the XML file it was made from, and is ignored when that hash does
+// not match.
+//
+// Strings in the blob have the same layout as in a SymbolTable's arena, so
+// they are adopted by the registry's symbol table in place instead of being
+// copied, and the mapping is kept for as long as the registry exists.
+//
+// Layout (all integers are stored in native byte order):
+//   SnapshotHeader
+//   string blob: `string_count` distinct strings, each stored as a uint32_t
+//                length followed by the NUL-terminated characters, padded to
+//                4 bytes
+//   word stream: uint32_t values describing the registry contents; strings
+//                are stored as 1-based indices into the blob, 0 being the
+//                empty string.
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t format_version;
+  uint32_t byte_order_mark;
+  uint64_t source_hash;
+  uint32_t blob_size;
+  uint32_t word_count;
+  uint32_t string_count;
+  uint32_t reserved;
+};
+
+const char kSnapshotMagic[8] = {'G', 'A', 'L', 'O', 'G', 'E', 'N', 'S'};
+const uint32_t kSnapshotFormatVersion = 4;
+const uint32_t kSnapshotByteOrderMark = 0x01020304;
+
+class SnapshotWriter {
+public:
+  void putWord(uint32_t word) { words_.push_back(word); }
+
+  // Symbols are interned, so each distinct string is stored only once.
+  void putString(Symbol str) {
+    if (str.empty()) {
+      putWord(0);
+      return;
+    }
+    auto it = indices_.find(str);
+    if (it == indices_.end()) {
+      it = indices_.emplace(str, (uint32_t)indices_.size() + 1).first;
+      uint32_t length = (uint32_t)str.size();
+      blob_.append(reinterpret_cast<const char*>(&length), sizeof(length));
+      blob_.append(str.c_str(), str.size() + 1);
+      blob_.resize((blob_.size() + 3) & ~(size_t)3, '\0');
+    }
+    putWord(it->second);
+  }
+
+  void putUint64(uint64_t value) {
+    putWord((uint32_t)value);
+    putWord((uint32_t)(value >> 32));
+  }
+
+  // Atomically replaces the file at the given path with the snapshot.
+  bool save(const std::string &path,
+            const char (&magic)[8],
+            uint32_t format_version,
+            uint64_t source_hash) {
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.format_version = format_version;
+    header.byte_order_mark = kSnapshotByteOrderMark;
+    header.source_hash = source_hash;
+    header.blob_size = (uint32_t)blob_.size();
+    header.word_count = (uint32_t)words_.size();
+    header.string_count = (uint32_t)indices_.size();
+    std::string temp_path;
+    FILE *f = createTempFile(path, &temp_path);
+    if (f == nullptr) {
+      return false;
+    }
+    bool ok =
+        fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(blob_.data(), 1, blob_.size(), f) == blob_.size() &&
+        fwrite(words_.data(), sizeof(uint32_t), words_.size(), f) ==
+            words_.size();
+    ok = (fclose(f) == 0) && ok;
+#if defined(_WIN32)
+    remove(path.c_str());
+#endif
+    ok = ok && rename(temp_path.c_str(), path.c_str()) == 0;
+    if (!ok) {
+      remove(temp_path.c_str());
+    }
+    return ok;
+  }
+
+private:
+  std::string blob_;
+  std::unordered_map<Symbol, uint32_t, SymbolHash> indices_;
+  std::vector<uint32_t> words_;
+};
+
+class SnapshotReader {
+public:
+  SnapshotReader(const char *blob, size_t blob_size,
+                 const char *words, size_t word_count,
+                 SymbolTable *symbols) :
+    blob_(blob), blob_size_(blob_size), words_(words), word_count_(word_count),
+    symbols_(symbols) {}
+
+  uint32_t getWord() {
+    uint32_t word = 0;
+    if (next_word_ < word_count_) {
+      memcpy(&word, words_ + next_word_ * sizeof(uint32_t), sizeof(word));
+      ++next_word_;
+    } else {
+      ok_ = false;
+    }
+    return word;
+  }
+
+  // Reads an element count. Every element takes up at least one word, so
+  // counts exceeding the number of remaining words indicate corruption.
+  uint32_t getCount() {
+    uint32_t count = getWord();
+    if (count > word_count_ - next_word_) {
+      ok_ = false;
+      count = 0;
+    }
+    return count;
+  }
+
+  uint64_t getUint64() {
+    uint64_t low = getWord();
+    return low | (uint64_t)getWord() << 32;
+  }
+
+  // Adopts all strings of the blob into the symbol table. Must be called
+  // before reading any strings. Returns false if the blob is malformed.
+  bool adoptStrings(size_t string_count) {
+    if (string_count > blob_size_ / 8) {
+      return false;
+    }
+    symbols_->reserve(string_count);
+    strings_.reserve(string_count + 1);
+    strings_.push_back(Symbol());
+    size_t pos = 0;
+    for (size_t i = 0; i < string_count; ++i) {
+      uint32_t length = 0;
+      if (blob_size_ - pos < sizeof(length)) {
+        return false;
+      }
+      memcpy(&length, blob_ + pos, sizeof(length));
+      pos += sizeof(length);
+      if (length == 0 || blob_size_ - pos <= length ||
+          blob_[pos + length] != '\0') {
+        return false;
+      }
+      strings_.push_back(symbols_->adopt(blob_ + pos, length));
+      pos = (pos + length + 1 + 3) & ~(size_t)3;
+    }
+    return pos == blob_size_;
+  }
+
+  Symbol getString() {
+    uint32_t index = getWord();
+    if (index >= strings_.size()) {
+      ok_ = false;
+      return Symbol();
+    }
+    return strings_[index];
+  }
+
+  // Returns false if any read so far was out of bounds.
+  bool ok() const { return ok_; }
+
+  bool atEnd() const { return next_word_ == word_count_; }
+
+private:
+  const char *blob_;
+  size_t blob_size_;
+  const char *words_;
+  size_t word_count_;
+  SymbolTable *symbols_;
+  std::vector<Symbol> strings_;
+  size_t next_word_ = 0;
+  bool ok_ = true;
+};
+
+void writeEntity(SnapshotWriter &w, const TypeInfo &info) {
+  w.putString(info.name);
+  w.putString(info.type_cdecl);
+  w.putString(info.prerequisite_type);
+  w.putString(info.api);
+}
+
+void readEntity(SnapshotReader &r, TypeInfo *info) {
+  info->name = r.getString();
+  info->type_cdecl = r.getString();
+  info->prerequisite_type = r.getString();
+  info->api = r.getString();
+}
+
+void writeEntity(SnapshotWriter &w, const EnumerantInfo &info) {
+  w.putString(info.name);
+  w.putString(info.alias);
+  w.putString(info.value);
+  w.putString(info.suffix);
+  w.putString(info.api);
+}
+
+void readEntity(SnapshotReader &r, EnumerantInfo *info) {
+  info->name = r.getString();
+  info->alias = r.getString();
+  info->value = r.getString();
+  info->suffix = r.getString();
+  info->api = r.getString();
+}
+
+void writeEntity(SnapshotWriter &w, const GroupInfo &info) {
+  w.putString(info.name);
+  w.putWord((uint32_t)info.enum_names.size());
+  for (Symbol enum_name : info.enum_names) {
+    w.putString(enum_name);
+  }
+}
+
+void readEntity(SnapshotReader &r, GroupInfo *info) {
+  info->name = r.getString();
+  uint32_t enum_count = r.getCount();
+  for (uint32_t i = 0; i < enum_count; ++i) {
+    info->enum_names.push_back(r.getString());
+  }
+}
+
+void writeEntity(SnapshotWriter &w, const CommandInfo &info) {
+  w.putString(info.name);
+  w.putString(info.prototype);
+  w.putString(info.return_ctype);
+  w.putString(info.referenced_api_type);
+  w.putString(info.alias);
+  w.putString(info.vecequiv);
+  w.putString(info.api);
+  w.putWord((uint32_t)info.parameters.size());
+  for (const CommandInfo::ParamInfo &param : info.parameters) {
+    w.putString(param.name);
+    w.putString(param.ctype);
+    w.putString(param.referenced_api_type);
+    w.putString(param.group);
+    w.putString(param.len);
+  }
+}
+
+void readEntity(SnapshotReader &r, CommandInfo *info) {
+  info->name = r.getString();
+  info->prototype = r.getString();
+  info->return_ctype = r.getString();
+  info->referenced_api_type = r.getString();
+  info->alias = r.getString();
+  info->vecequiv = r.getString();
+  info->api = r.getString();
+  uint32_t param_count = r.getCount();
+  info->parameters.resize(param_count);
+  for (CommandInfo::ParamInfo &param : info->parameters) {
+    param.name = r.getString();
+    param.ctype = r.getString();
+    param.referenced_api_type = r.getString();
+    param.group = r.getString();
+    param.len = r.getString();
+  }
+}
+
+void writeEntity(SnapshotWriter &w, const OperationInfo &info) {
+  w.putWord(info.require ? 1u : 0u);
+  w.putString(info.profile);
+  w.putWord((uint32_t)info.entities.size());
+  for (const OperationInfo::EntityRef &ref : info.entities) {
+    w.putWord((uint32_t)ref.kind);
+    w.putString(ref.name);
+  }
+}
+
+void readEntity(SnapshotReader &r, OperationInfo *info) {
+  info->require = r.getWord() != 0;
+  info->profile = r.getString();
+  uint32_t ref_count = r.getCount();
+  info->entities.resize(ref_count);
+  for (OperationInfo::EntityRef &ref : info->entities) {
+    ref.kind = (EntityKind)std::min(r.getWord(), (uint32_t)EntityKind::kOther);
+    ref.name = r.getString();
+  }
+}
+
+void writeEntity(SnapshotWriter &w, const FeatureInfo &info) {
+  w.putString(info.api);
+  w.putString(info.name);
+  w.putString(info.number);
+  w.putWord((uint32_t)info.operations.size());
+  for (const OperationInfo &operation : info.operations) {
+    writeEntity(w, operation);
+  }
+}
+
+void readEntity(SnapshotReader &r, FeatureInfo *info) {
+  info->api = r.getString();
+  info->name = r.getString();
+  info->number = r.getString();
+  info->operations.resize(r.getCount());
+  for (OperationInfo &operation : info->operations) {
+    readEntity(r, &operation);
+  }
+}
+
+void writeEntity(SnapshotWriter &w, const ExtensionInfo &info) {
+  w.putString(info.name);
+  w.putString(info.supported);
+  w.putWord((uint32_t)info.operations.size());
+  for (const OperationInfo &operation : info.operations) {
+    writeEntity(w, operation);
+  }
+}
+
+void readEntity(SnapshotReader &r, ExtensionInfo *info) {
+  info->name = r.getString();
+  info->supported = r.getString();
+  info->operations.resize(r.getCount());
+  for (OperationInfo &operation : info->operations) {
+    readEntity(r, &operation);
+  }
+}
+
+// Entity maps are stored as a flat list of definitions. Definitions sharing a
+// name are stored in the order they were added, which preserves the lookup
+// behavior of ApiEntity::get.
+template <class T>
+void writeEntities(SnapshotWriter &w,
+                   const EntityMap<T> &map,
+                   const EntityIds &ids) {
+  uint32_t count = 0;
+  for (const auto &entry : map) {
+    count += (uint32_t)entry.second.variants().size();
+  }
+  w.putWord(count);
+  // Written in ID order, so that IDs are the same when the snapshot is read.
+  for (Symbol name : ids.names) {
+    auto entity_it = map.find(name);
+    if (entity_it == map.end()) {
+      continue;
+    }
+    for (const T &variant : entity_it->second.variants()) {
+      writeEntity(w, variant);
+    }
+  }
+}
+
+template <class T>
+void readEntities(SnapshotReader &r, EntityMap<T> &map, EntityIds &ids) {
+  uint32_t count = r.getCount();
+  for (uint32_t i = 0; i < count && r.ok(); ++i) {
+    T entity_info;
+    readEntity(r, &entity_info);
+    ids.get(entity_info.name);
+    map[entity_info.name].add(entity_info);
+  }
+}
+
+template <class T>
+void writeEntities(SnapshotWriter &w, const std::vector<T> &list) {
+  w.putWord((uint32_t)list.size());
+  for (const T &info : list) {
+    writeEntity(w, info);
+  }
+}
+
+template <class T>
+void readEntities(SnapshotReader &r, std::vector<T> &list) {
+  list.resize(r.getCount());
+  for (T &info : list) {
+    readEntity(r, &info);
+  }
+}
+
+bool saveSnapshot(const std::string &path,
+                  uint64_t source_hash,
+                  const Registry &registry) {
+  SnapshotWriter w;
+  writeEntities(w,
+                registry.types,
+                registry.entity_ids[EntityKind::kType]);
+  writeEntities(w,
+                registry.enums,
+                registry.entity_ids[EntityKind::kEnum]);
+  writeEntities(w,
+                registry.commands,
+                registry.entity_ids[EntityKind::kCommand]);
+  writeEntities(w,
+                registry.groups,
+                registry.entity_ids[EntityKind::kGroup]);
+  writeEntities(w, registry.features);
+  writeEntities(w, registry.extensions);
+  return w.save(path, kSnapshotMagic, kSnapshotFormatVersion, source_hash);
+}
+
+// Maps a file written by SnapshotWriter and reads its header. Returns false if
+// the file does not exist, is truncated, or has a different magic, format
+// version, byte order or source hash.
+bool openSnapshotFile(const std::string &path,
+                      const char (&magic)[8],
+                      uint32_t format_version,
+                      uint64_t source_hash,
+                      MappedFile *file,
+                      SnapshotHeader *header) {
+  if (!file->open(path.c_str()) || file->size() < sizeof(SnapshotHeader)) {
+    return false;
+  }
+  memcpy(header, file->data(), sizeof(*header));
+  return memcmp(header->magic, magic, sizeof(header->magic)) == 0 &&
+         header->format_version == format_version &&
+         header->byte_order_mark == kSnapshotByteOrderMark &&
+         header->source_hash == source_hash &&
+         file->size() == sizeof(*header) + header->blob_size +
+                         (size_t)header->word_count * sizeof(uint32_t);
+}
+
+// Returns false if the snapshot does not exist, is damaged or was made from a
+// different registry file. The registry is left in an unspecified state in
+// that case.
+bool loadSnapshot(const std::string &path,
+                  uint64_t source_hash,
+                  Registry *registry) {
+  std::unique_ptr<MappedFile> file(new MappedFile());
+  SnapshotHeader header;
+  if (!openSnapshotFile(path,
+                        kSnapshotMagic,
+                        kSnapshotFormatVersion,
+                        source_hash,
+                        file.get(),
+                        &header)) {
+    return false;
+  }
+  const char *blob = file->data() + sizeof(header);
+  SnapshotReader r(blob, header.blob_size,
+                   blob + header.blob_size, header.word_count,
+                   &registry->symbols);
+  if (!r.adoptStrings(header.string_count)) {
+    return false;
+  }
+  readEntities(r,
+               registry->types,
+               registry->entity_ids[EntityKind::kType]);
+  readEntities(r,
+               registry->enums,
+               registry->entity_ids[EntityKind::kEnum]);
+  readEntities(r,
+               registry->commands,
+               registry->entity_ids[EntityKind::kCommand]);
+  readEntities(r,
+               registry->groups,
+               registry->entity_ids[EntityKind::kGroup]);
+  readEntities(r, registry->features);
+  readEntities(r, registry->extensions);
+  if (!r.ok() || !r.atEnd()) {
+    return false;
+  }
+  registry->snapshot = std::move(file);
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+// Parallel registry loading.
+//
+// The sections of the registry are independent until the registry is
+// finished, so the file can be split into chunks of complete elements which
+// are scanned concurrently, each into a fragment with its own symbol table.
+// The fragments are then merged in document order, which numbers entities the
+// same way as scanning the whole file in one pass.
+
+// Calls task(0), ..., task(count - 1), spreading the calls over up to `jobs`
+// threads. If `jobs` is 0, uses one thread per hardware thread.
+void runParallel(size_t count,
+                 unsigned jobs,
+                 const std::function<void(size_t)> &task) {
+#if !defined(__EMSCRIPTEN__)
+  if (jobs == 0) {
+    jobs = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  jobs = (unsigned)std::min((size_t)jobs, count);
+  std::atomic<size_t> next_task(0);
+  auto worker = [&]() {
+    for (size_t i = next_task++; i < count; i = next_task++) {
+      task(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < jobs; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+#else
+  for (size_t i = 0; i < count; ++i) {
+    task(i);
+  }
+#endif
+}
+
+// Maps the symbols of a fragment to the symbols of the registry it is merged
+// into. Only symbols that the registry already had are mapped to a different
+// symbol (see SymbolTable::absorb()).
+struct SymbolRemap {
+  std::unordered_map<Symbol, Symbol, SymbolHash> duplicates;
+
+  Symbol operator()(Symbol symbol) const {
+    if (duplicates.empty()) {
+      return symbol;
+    }
+    auto it = duplicates.find(symbol);
+    return it == duplicates.end() ? symbol : it->second;
+  }
+
+  void apply(Symbol *symbol) const { *symbol = (*this)(*symbol); }
+};
+
+void remapSymbols(const SymbolRemap &remap, TypeInfo *info) {
+  remap.apply(&info->name);
+  remap.apply(&info->type_cdecl);
+  remap.apply(&info->prerequisite_type);
+  remap.apply(&info->api);
+}
+
+void remapSymbols(const SymbolRemap &remap, EnumerantInfo *info) {
+  remap.apply(&info->name);
+  remap.apply(&info->alias);
+  remap.apply(&info->value);
+  remap.apply(&info->suffix);
+  remap.apply(&info->api);
+}
+
+void remapSymbols(const SymbolRemap &remap, GroupInfo *info) {
+  remap.apply(&info->name);
+  for (Symbol &enum_name : info->enum_names) {
+    remap.apply(&enum_name);
+  }
+  remap.apply(&info->api);
+}
+
+void remapSymbols(const SymbolRemap &remap, CommandInfo *info) {
+  remap.apply(&info->name);
+  remap.apply(&info->prototype);
+  remap.apply(&info->return_ctype);
+  remap.apply(&info->referenced_api_type);
+  for (CommandInfo::ParamInfo &param : info->parameters) {
+    remap.apply(&param.name);
+    remap.apply(&param.ctype);
+    remap.apply(&param.referenced_api_type);
+    remap.apply(&param.group);
+    remap.apply(&param.len);
+  }
+  remap.apply(&info->alias);
+  remap.apply(&info->vecequiv);
+  remap.apply(&info->api);
+}
+
+void remapSymbols(const SymbolRemap &remap, OperationInfo *info) {
+  remap.apply(&info->profile);
+  for (OperationInfo::EntityRef &entity_ref : info->entities) {
+    remap.apply(&entity_ref.name);
+  }
+}
+
+void remapSymbols(const SymbolRemap &remap, FeatureInfo *info) {
+  remap.apply(&info->api);
+  remap.apply(&info->name);
+  remap.apply(&info->number);
+  for (OperationInfo &operation : info->operations) {
+    remapSymbols(remap, &operation);
+  }
+}
+
+void remapSymbols(const SymbolRemap &remap, ExtensionInfo *info) {
+  remap.apply(&info->name);
+  remap.apply(&info->supported);
+  for (OperationInfo &operation : info->operations) {
+    remapSymbols(remap, &operation);
+  }
+}
+
+template <class T>
+void remapSymbols(const SymbolRemap &remap, EntityMap<T> *map) {
+  for (auto &entry : *map) {
+    for (T &variant : entry.second.variants()) {
+      remapSymbols(remap, &variant);
+    }
+  }
+}
+
+template <class T>
+void remapSymbols(const SymbolRemap &remap, std::vector<T> *list) {
+  for (T &info : *list) {
+    remapSymbols(remap, &info);
+  }
+}
+
+// Moves the entities of a fragment into `map`, numbering new names in the
+// order in which the fragment defines them, and frees the fragment's map. The
+// keys of `fragment_map` and `fragment_ids` are symbols of the fragment.
+template <class T>
+void mergeEntities(const SymbolRemap &remap,
+                   EntityMap<T> &fragment_map,
+                   EntityIds &fragment_ids,
+                   EntityMap<T> &map,
+                   EntityIds &ids) {
+  for (Symbol fragment_name : fragment_ids.names) {
+    Symbol name = remap(fragment_name);
+    ids.get(name);
+    map[name].append(std::move(fragment_map[fragment_name]));
+  }
+  fragment_map = EntityMap<T>();
+  fragment_ids = EntityIds();
+}
+
+// Scans the registry file in chunks on up to `jobs` threads (all hardware
+// threads if 0) and merges the results into `registry`. If `lazy` is set,
+// commands are deferred as with RegistryBuilder::deferCommands(). Returns
+// false and sets `*error` on failure.
+bool scanParallel(const char *data,
+                  size_t size,
+                  bool lazy,
+                  unsigned jobs,
+                  Registry *registry,
+                  std::string *error,
+                  Timings *timings) {
+  // Big enough that per-chunk overhead stays small, small enough that every
+  // thread gets several chunks to even out differences in chunk cost.
+  static const size_t kMinChunkSize = 64 * 1024;
+  if (jobs == 0) {
+    jobs = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  std::vector<XmlChunk> chunks;
+  {
+    ScopedTimer timer(timings, "load: split XML");
+    static const std::vector<std::pair<std::string, std::string>>
+        kSections = {
+          {"types", "type"},
+          {"commands", "command"},
+          {"groups", "group"},
+          {"extensions", "extension"}
+        };
+    XmlScanner scanner(data, size);
+    if (!scanner.split(std::max(size / (jobs * 4), kMinChunkSize),
+                       kSections,
+                       &chunks,
+                       error)) {
+      return false;
+    }
+  }
+
+  std::vector<Registry> fragments(chunks.size());
+  std::vector<std::string> errors(chunks.size());
+  {
+    ScopedTimer timer(timings, "load: parse XML");
+    runParallel(chunks.size(), jobs, [&](size_t i) {
+      const XmlChunk &chunk = chunks[i];
+      RegistryBuilder builder(&fragments[i]);
+      if (lazy) {
+        builder.deferCommands(data);
+      }
+      builder.startElement("registry", nullptr, 0, chunk.line);
+      if (!chunk.section.empty()) {
+        builder.startElement(chunk.section.c_str(), nullptr, 0, chunk.line);
+      }
+      XmlScanner scanner(chunk.begin, chunk.end - chunk.begin, chunk.line);
+      scanner.scan(&builder, &errors[i]);
+    });
+  }
+  for (const std::string &chunk_error : errors) {
+    if (!chunk_error.empty()) {
+      *error = chunk_error;
+      return false;
+    }
+  }
+
+  ScopedTimer timer(timings, "load: merge fragments");
+  // Strings that occur in several fragments are kept from the first one.
+  const size_t shard_count = SymbolTable::kShardCount;
+  std::vector<std::vector<std::pair<Symbol, Symbol>>> duplicates(
+      fragments.size() * shard_count);
+  runParallel(shard_count, jobs, [&](size_t shard) {
+    for (size_t i = 0; i < fragments.size(); ++i) {
+      registry->symbols.absorbShard(shard,
+                                    fragments[i].symbols,
+                                    &duplicates[i * shard_count + shard]);
+    }
+  });
+  for (Registry &fragment : fragments) {
+    registry->symbols.absorbStorage(std::move(fragment.symbols));
+  }
+  std::vector<SymbolRemap> remaps(fragments.size());
+  runParallel(fragments.size(), jobs, [&](size_t i) {
+    for (size_t shard = 0; shard < shard_count; ++shard) {
+      const auto &shard_duplicates = duplicates[i * shard_count + shard];
+      remaps[i].duplicates.insert(shard_duplicates.begin(),
+                                  shard_duplicates.end());
+    }
+    if (remaps[i].duplicates.empty()) {
+      return;
+    }
+    Registry &fragment = fragments[i];
+    remapSymbols(remaps[i], &fragment.types);
+    remapSymbols(remaps[i], &fragment.enums);
+    remapSymbols(remaps[i], &fragment.commands);
+    remapSymbols(remaps[i], &fragment.groups);
+    remapSymbols(remaps[i], &fragment.features);
+    remapSymbols(remaps[i], &fragment.extensions);
+  });
+
+  // Each kind of entity is merged by a separate task, in document order.
+  std::vector<std::function<void(const SymbolRemap&, Registry&)>> mergers = {
+    [&](const SymbolRemap &remap, Registry &fragment) {
+      mergeEntities(remap,
+                    fragment.types,
+                    fragment.entity_ids[EntityKind::kType],
+                    registry->types,
+                    registry->entity_ids[EntityKind::kType]);
+    },
+    [&](const SymbolRemap &remap, Registry &fragment) {
+      mergeEntities(remap,
+                    fragment.enums,
+                    fragment.entity_ids[EntityKind::kEnum],
+                    registry->enums,
+                    registry->entity_ids[EntityKind::kEnum]);
+    },
+    [&](const SymbolRemap &remap, Registry &fragment) {
+      mergeEntities(remap,
+                    fragment.commands,
+                    fragment.entity_ids[EntityKind::kCommand],
+                    registry->commands,
+                    registry->entity_ids[EntityKind::kCommand]);
+      for (auto &entry : fragment.unparsed_commands) {
+        std::vector<Registry::SourceRange> &ranges =
+            registry->unparsed_commands[remap(entry.first)];
+        ranges.insert(ranges.end(), entry.second.begin(), entry.second.end());
+      }
+    },
+    [&](const SymbolRemap &remap, Registry &fragment) {
+      mergeEntities(remap,
+                    fragment.groups,
+                    fragment.entity_ids[EntityKind::kGroup],
+                    registry->groups,
+                    registry->entity_ids[EntityKind::kGroup]);
+    },
+    // Features and extensions were remapped in place above, and are not
+    // indexed by name, so they are moved over as they are.
+    [&](const SymbolRemap&, Registry &fragment) {
+      for (FeatureInfo &feature : fragment.features) {
+        registry->features.push_back(std::move(feature));
+      }
+      for (ExtensionInfo &extension : fragment.extensions) {
+        registry->extensions.push_back(std::move(extension));
+      }
+    }
+  };
+  runParallel(mergers.size(), jobs, [&](size_t task) {
+    for (size_t i = 0; i < fragments.size(); ++i) {
+      mergers[task](remaps[i], fragments[i]);
+    }
+  });
+  return true;
+}
+
+// Loads the registry from the XML file given in the options. If a snapshot
+// path is given, the registry is loaded from the snapshot when it is up to
+// date, and the snapshot is (re)created otherwise. If `timings` is not null,
+// the time spent in each step is added to it. Returns false and sets `*error`
+// if the registry can not be loaded.
+bool loadRegistry(const RegistryLoadOptions &options,
+                  Registry *registry,
+                  std::string *error,
+                  Timings *timings = nullptr) {
+  std::unique_ptr<MappedFile> registry_file(new MappedFile());
+  {
+    ScopedTimer timer(timings, "load: read file");
+    if (!registry_file->open(options.file_name.c_str())) {
+      *error = "Failed to load file " + options.file_name;
+      return false;
+    }
+  }
+  uint64_t source_hash = 0;
+  if (!options.snapshot_file_name.empty()) {
+    {
+      ScopedTimer timer(timings, "load: hash file");
+      source_hash = hashBytes(registry_file->data(), registry_file->size());
+    }
+    bool loaded = false;
+    {
+      ScopedTimer timer(timings, "load: read snapshot");
+      loaded = loadSnapshot(options.snapshot_file_name, source_hash, registry);
+    }
+    if (loaded) {
+      ScopedTimer timer(timings, "load: finish registry");
+      return finishRegistry(registry, error);
+    }
+    *registry = Registry();
+  }
+  RegistryBuilder builder(registry);
+  bool lazy = options.lazy_commands && options.snapshot_file_name.empty();
+  if (options.parser == XmlParser::kTinyXml2) {
+    tinyxml2::XMLDocument spec;
+    {
+      ScopedTimer timer(timings, "load: parse XML document");
+      if (spec.Parse(registry_file->data(), registry_file->size()) !=
+          tinyxml2::XML_SUCCESS) {
+        *error = "Failed to load file " + options.file_name;
+        return false;
+      }
+    }
+    ScopedTimer timer(timings, "load: build registry");
+    DomEventSource events(&builder);
+    spec.Accept(&events);
+    if (builder.failed()) {
+      *error = builder.error();
+      return false;
+    }
+  } else if (options.parser == XmlParser::kParallel) {
+    if (!scanParallel(registry_file->data(),
+                      registry_file->size(),
+                      lazy,
+                      options.jobs,
+                      registry,
+                      error,
+                      timings)) {
+      return false;
+    }
+    if (lazy) {
+      registry->source = std::move(registry_file);
+    }
+  } else {
+    ScopedTimer timer(timings, "load: parse XML");
+    if (lazy) {
+      builder.deferCommands(registry_file->data());
+    }
+    XmlScanner scanner(registry_file->data(), registry_file->size());
+    if (!scanner.scan(&builder, error)) {
+      return false;
+    }
+    if (lazy) {
+      registry->source = std::move(registry_file);
+    }
+  }
+  {
+    ScopedTimer timer(timings, "load: finish registry");
+    if (!finishRegistry(registry, error)) {
+      return false;
+    }
+  }
+  if (!options.snapshot_file_name.empty()) {
+    ScopedTimer timer(timings, "load: write snapshot");
+    if (!saveSnapshot(options.snapshot_file_name, source_hash, *registry)) {
+      fprintf(stderr, "WARNING: failed to write registry snapshot %s\n",
+              options.snapshot_file_name.c_str());
+    }
+  }
+  return true;
+}
+
+#if defined(GALOGEN_HAS_MMAP)
+// Returns the modification time from `st` in nanoseconds since the epoch. How
+// precise it is depends on the file system.
+uint64_t modificationTime(const struct stat &st) {
+#if defined(__APPLE__)
+  const struct timespec &mtime = st.st_mtimespec;
+#else
+  const struct timespec &mtime = st.st_mtim;
+#endif
+  return (uint64_t)mtime.tv_sec * 1000000000ull + (uint64_t)mtime.tv_nsec;
+}
+#endif
+
+// Identifies the version of a file: by inode, size and modification time
+// where available, which is cheap, and by a hash of the contents otherwise.
+// Returns false if the file can not be read.
+bool fileVersion(const std::string &path, std::vector<uint64_t> *version) {
+#if defined(GALOGEN_HAS_MMAP)
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  *version = {(uint64_t)st.st_dev, (uint64_t)st.st_ino,
+              (uint64_t)st.st_size, modificationTime(st)};
+#else
+  MappedFile file;
+  if (!file.open(path.c_str())) {
+    return false;
+  }
+  *version = {(uint64_t)file.size(), hashBytes(file.data(), file.size())};
+#endif
+  return true;
+}
+
+// Keeps the most recently loaded registry for later runs in the same process.
+// In the web build, main() runs once for every click on "Generate", and
+// parsing the registry would otherwise dominate each run. The command line
+// tool goes through the same path, so both behave alike.
+class RegistryCache {
+public:
+  // Returns the registry for the given options, loading it unless the cached
+  // registry was loaded with the same options from the same version of the
+  // file (see fileVersion()). Returns nullptr and sets `*error` on failure.
+  // The registry stays valid until the next call.
+  const Registry* load(const RegistryLoadOptions &options,
+                       std::string *error,
+                       Timings *timings = nullptr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<uint64_t> version;
+    {
+      ScopedTimer timer(timings, "load: check cache");
+      if (!fileVersion(options.file_name, &version)) {
+        *error = "Failed to load file " + options.file_name;
+        return nullptr;
+      }
+    }
+    if (registry_ != nullptr &&
+        version == version_ &&
+        options.file_name == options_.file_name &&
+        options.snapshot_file_name == options_.snapshot_file_name &&
+        options.parser == options_.parser &&
+        options.lazy_commands == options_.lazy_commands) {
+      return registry_.get();
+    }
+    registry_.reset();
+    std::unique_ptr<Registry> registry(new Registry());
+    if (!loadRegistry(options, registry.get(), error, timings)) {
+      return nullptr;
+    }
+    registry_ = std::move(registry);
+    options_ = options;
+    version_ = version;
+    return registry_.get();
+  }
+
+private:
+  std::mutex mutex_;
+  std::unique_ptr<Registry> registry_;
+  RegistryLoadOptions options_;
+  std::vector<uint64_t> version_;
+};
+
+RegistryCache& registryCache() {
+  static RegistryCache cache;
+  return cache;
+}
+
+// Like findCommand(), but registry->mutex must already be locked if the
+// registry has a source.
+const ApiEntity<CommandInfo>* findCommandLocked(Registry *registry,
+                                                Symbol name,
+                                                std::string *error) {
+  auto unparsed_it = registry->unparsed_commands.find(name);
+  if (unparsed_it != registry->unparsed_commands.end()) {
+    const char *source = registry->source->data();
+    for (const Registry::SourceRange &range : unparsed_it->second) {
+      RegistryBuilder builder(registry);
+      builder.startInCommands();
+      XmlScanner scanner(source + range.begin,
+                         range.end - range.begin,
+                         range.line);
+      if (!scanner.scan(&builder, error)) {
+        return nullptr;
+      }
+    }
+    registry->unparsed_commands.erase(unparsed_it);
+  }
+  auto command_it = registry->commands.find(name);
+  if (command_it == registry->commands.end()) {
+    *error = "Reference to undefined command " + name.str();
+    return nullptr;
+  }
+  return &command_it->second;
+}
+
+// Looks up a command, parsing it first if it was loaded lazily. Returns
+// nullptr and sets `*error` if the registry has no command with the given
+// name, or if the command can not be parsed. Safe to call concurrently on the
+// same registry.
+const ApiEntity<CommandInfo>* findCommand(const Registry &registry,
+                                          Symbol name,
+                                          std::string *error) {
+  std::unique_lock<std::mutex> lock;
+  if (registry.source != nullptr) {
+    lock = std::unique_lock<std::mutex>(*registry.mutex);
+  }
+  // Parsing a deferred command only fills in its entry and interns new
+  // strings, which is why const registries may do it (under the lock).
+  return findCommandLocked(const_cast<Registry*>(&registry), name, error);
+}
+
+// Returns the symbol for the given string, or an empty symbol if no entity in
+// the registry uses it. Safe to call concurrently with findCommand().
+Symbol findSymbol(const Registry &registry, const std::string &s) {
+  std::unique_lock<std::mutex> lock;
+  if (registry.source != nullptr) {
+    lock = std::unique_lock<std::mutex>(*registry.mutex);
+  }
+  return registry.symbols.find(s);
+}
+
+// Returns the definition of each entity in `map` for the given API, indexed
+// by ID.
+template <class T>
+std::vector<const T*> definitionsForApi(const EntityMap<T> &map,
+                                        const EntityIds &ids,
+                                        Symbol api) {
+  std::vector<const T*> definitions(ids.names.size(), nullptr);
+  for (size_t id = 0; id < ids.names.size(); ++id) {
+    auto entity_it = map.find(ids.names[id]);
+    if (entity_it != map.end()) {
+      definitions[id] = entity_it->second.get(api);
+    }
+  }
+  return definitions;
+}
+
+// Returns the entry of `definitions` for the given ID, or null if there is
+// none.
+template <class T>
+const T* findDefinition(const std::vector<const T*> &definitions, uint32_t id) {
+  return id < definitions.size() ? definitions[id] : nullptr;
+}
+
+// Returns the view of the given API, building it on first use. Must be called
+// with registry->mutex locked. Once built, entries only change from null to
+// the definition of a lazily loaded command, under the lock, so a thread may
+// read the entries of the entities it has resolved without the lock.
+ApiView* findApiView(Registry *registry, Symbol api, Timings *timings) {
+  auto view_it = registry->api_views.find(api);
+  if (view_it != registry->api_views.end()) {
+    return &view_it->second;
+  }
+  ScopedTimer timer(timings, "resolve: build API view");
+  ApiView &view = registry->api_views[api];
+  view.types = definitionsForApi(registry->types,
+                                 registry->entity_ids[EntityKind::kType],
+                                 api);
+  view.enums = definitionsForApi(registry->enums,
+                                 registry->entity_ids[EntityKind::kEnum],
+                                 api);
+  // Commands that have not been parsed yet have no definitions, and are
+  // added by resolveCommandLocked().
+  view.commands = definitionsForApi(registry->commands,
+                                    registry->entity_ids[EntityKind::kCommand],
+                                    api);
+  std::vector<const GroupInfo*> groups =
+      definitionsForApi(registry->groups,
+                        registry->entity_ids[EntityKind::kGroup],
+                        api);
+  view.groups.assign(groups.size(), nullptr);
+  for (size_t id = 0; id < groups.size(); ++id) {
+    if (groups[id] == nullptr) {
+      continue;
+    }
+    GroupInfo resolved_group = *groups[id];
+    bool complete = true;
+    for (Symbol enum_name : resolved_group.enum_names) {
+      auto enum_it = registry->enums.find(enum_name);
+      const EnumerantInfo *enum_info =
+          enum_it != registry->enums.end() ? enum_it->second.get(api) : nullptr;
+      if (enum_info == nullptr) {
+        complete = false;
+        break;
+      }
+      resolved_group.enums.push_back(enum_info);
+    }
+    if (complete) {
+      view.resolved_groups.push_back(std::move(resolved_group));
+      view.groups[id] = &view.resolved_groups.back();
+    }
+  }
+  return &view;
+}
+
+// Returns the definition of the command with the given ID for an API, parsing
+// the command first if it was loaded lazily, and records it in the API's view.
+// Returns nullptr and sets `*error` if the command is undefined, can not be
+// parsed or has no definition for the API. Must be called with
+// registry->mutex locked.
+const CommandInfo* resolveCommandLocked(Registry *registry,
+                                        ApiView *view,
+                                        Symbol api,
+                                        uint32_t id,
+                                        std::string *error) {
+  const CommandInfo *command = findDefinition(view->commands, id);
+  if (command != nullptr) {
+    return command;
+  }
+  Symbol name = registry->entity_ids[EntityKind::kCommand].names[id];
+  const ApiEntity<CommandInfo> *command_entity =
+      findCommandLocked(registry, name, error);
+  if (command_entity == nullptr) {
+    return nullptr;
+  }
+  command = command_entity->get(api);
+  if (command == nullptr) {
+    *error = formatMessage("Failed to find command %s for api %s",
+                           name.c_str(),
+                           api.c_str());
+    return nullptr;
+  }
+  if (id < view->commands.size()) {
+    view->commands[id] = command;
+  }
+  return command;
+}
+
+extern const char *source_preamble;
+extern const char *header_preamble;
+
+struct GenerationOptions {
+  RegistryLoadOptions registry;
+  std::string batch_file_name;
+  std::string serve_address;
+  unsigned jobs = 0;
+  ReportFormat timings = ReportFormat::kNone;
+  ReportFormat stats = ReportFormat::kNone;
+  std::string api_name;
+  ApiVersion api_version;
+  std::string profile;
+  std::string generator_name;
+  std::string filename;
+  std::unordered_set<std::string> extensions;
+
+  // If not empty, only entities used by the sources in these directories are
+  // generated (see scanUsage()).
+  std::vector<std::string> usage_dirs;
+
+  // If not empty, path of the index that makes repeated usage scans only read
+  // changed files (see UsageIndex).
+  std::string usage_cache_file_name;
+};
+
+// Returns the entities added or removed by an operation as bitsets. For
+// <require> elements, these include the types and groups referenced by the
+// signatures of the required commands, which is why operations are compiled
+// separately for each API. Returns nullptr and sets `*error` if a required
+// command is not available. Must be called with registry->mutex locked.
+const EntityBitsets* compileOperation(Registry *registry,
+                                      Symbol api,
+                                      const OperationInfo &operation,
+                                      std::string *error) {
+  std::unordered_map<const OperationInfo*, EntityBitsets> &compiled =
+      registry->compiled_operations[api];
+  auto compiled_it = compiled.find(&operation);
+  if (compiled_it != compiled.end()) {
+    return &compiled_it->second;
+  }
+  EntityBitsets bits;
+  ApiView *view = findApiView(registry, api, nullptr);
+  for (const OperationInfo::EntityRef &entity_ref : operation.entities) {
+    EntityKind entity_type = entity_ref.kind;
+    Symbol name_attrib = entity_ref.name;
+    uint32_t id = registry->entity_ids[entity_type].get(name_attrib);
+    bits[entity_type].insert(id);
+    if (operation.require && entity_type == EntityKind::kCommand) {
+      // Types are (usually) not directly specified in the feature
+      // element. They are supposed to be picked up transitively via 
+      // command signatures. Same applies to groups.
+      const CommandInfo *command =
+          resolveCommandLocked(registry, view, api, id, error);
+      if (command == nullptr) {
+        return nullptr;
+      }
+      EntityIds &type_ids = registry->entity_ids[EntityKind::kType];
+      EntityIds &group_ids = registry->entity_ids[EntityKind::kGroup];
+      if (!command->referenced_api_type.empty()) {
+        bits[EntityKind::kType].insert(
+            type_ids.get(command->referenced_api_type));
+      }
+      for (const CommandInfo::ParamInfo &param : command->parameters) {
+        if (!param.referenced_api_type.empty()) {
+          bits[EntityKind::kType].insert(
+              type_ids.get(param.referenced_api_type));
+        }
+        if(!param.group.empty()) {
+          bits[EntityKind::kGroup].insert(group_ids.get(param.group));
+        }
+      }
+    }
+  }
+  return &compiled.emplace(&operation, std::move(bits)).first->second;
+}
+
+// Applies a list of operations to a set of entities. Operations restricted to
+// a different profile are skipped. Returns false and sets `*error` if an
+// operation can not be compiled. Must be called with registry->mutex locked.
+bool applyOperations(Registry *registry,
+                     Symbol api,
+                     Symbol profile,
+                     const std::vector<OperationInfo> &operations,
+                     EntityBitsets &entity_sets,
+                     std::string *error) {
+  for (const OperationInfo &operation : operations) {
+    if (!operation.profile.empty() && operation.profile != profile) {
+      continue;
+    }
+    const EntityBitsets *bits =
+        compileOperation(registry, api, operation, error);
+    if (bits == nullptr) {
+      return false;
+    }
+    for (size_t kind = 0; kind < kEntityKindCount; ++kind) {
+      EntityKind entity_kind = (EntityKind)kind;
+      if (operation.require) {
+        entity_sets[entity_kind].insertAll((*bits)[entity_kind]);
+      } else {
+        entity_sets[entity_kind].eraseAll((*bits)[entity_kind]);
+      }
+    }
+  }
+  return true;
+}
+
+// Returns the entities making up each version of the given API profile,
+// computing them on first use. Returns nullptr and sets `*error` if a feature
+// can not be applied. Must be called with registry->mutex locked.
+const FeatureLevels* findFeatureLevels(Registry *registry,
+                                       Symbol api,
+                                       Symbol profile,
+                                       std::string *error,
+                                       Timings *timings) {
+  std::unordered_map<Symbol, FeatureLevels, SymbolHash> &api_levels =
+      registry->feature_levels[api];
+  auto levels_it = api_levels.find(profile);
+  if (levels_it != api_levels.end()) {
+    return &levels_it->second;
+  }
+
+  // Each API version is described in a "feature" element.
+  // The contents of the tag specify the difference against the previous version
+  // (i.e. which types/commands/enums were added or removed).
+  // Therefore, to get the full description of an API version, we need to
+  // process all feature elements up to and including the required version, in
+  // order of increasing version.
+  // Its is not guaranteed that the "feature" elements will appear in any
+  //  particular order, so we sort them first.
+  std::vector<const FeatureInfo*> feature_elements;
+  std::vector<ApiVersion> api_version_numbers;
+  for (const FeatureInfo &feature : registry->features) {
+    if (!api.empty() && feature.api == api) {
+      feature_elements.push_back(&feature);
+      api_version_numbers.push_back(ApiVersion(feature.number.c_str()));
+    }
+  }
+  std::vector<size_t> feature_order(feature_elements.size());
+  {
+    ScopedTimer timer(timings, "resolve: sort features");
+    for (size_t i = 0; i < feature_order.size(); ++i) { feature_order[i] = i; }
+    std::stable_sort(feature_order.begin(),
+                     feature_order.end(),
+                     [&api_version_numbers](size_t i1, size_t i2) {
+                       return api_version_numbers[i2] > api_version_numbers[i1];
+                     });
+  }
+
+  ScopedTimer timer(timings, "resolve: apply features");
+  FeatureLevels levels;
+  EntityBitsets entity_sets;
+  for (size_t feature_idx : feature_order) {
+    if (!applyOperations(registry,
+                         api,
+                         profile,
+                         feature_elements[feature_idx]->operations,
+                         entity_sets,
+                         error)) {
+      return nullptr;
+    }
+    levels.versions.push_back(api_version_numbers[feature_idx]);
+    levels.entities.push_back(entity_sets);
+  }
+  return &api_levels.emplace(profile, std::move(levels)).first->second;
+}
+
+// Usage scanning
+//
+// With --usage-dirs, the sources of the program that is going to use the
+// loader are searched for identifiers that could name GL commands and
+// enumerants, and the commands and enumerants they do not name are left out of
+// the generated files.
+
+bool isIdentifierChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
+}
+
+// Adds the identifiers in [begin, end) that start with "gl" or "GL" to
+// `identifiers`. Comments and string literals are not skipped, so an entry
+// point that is only mentioned in a comment is kept.
+void scanIdentifiers(const char *begin,
+                     const char *end,
+                     std::unordered_set<std::string> *identifiers) {
+  // Reused, so that identifiers that were already seen are not allocated.
+  std::string word;
+  const char *p = begin;
+  while ((p = findAnyOf(p, end, 'g', 'G', 'G')) < end) {
+    const char *identifier = p;
+    bool starts_identifier = p == begin || !isIdentifierChar(p[-1]);
+    for (++p; p < end && isIdentifierChar(*p); ++p) {}
+    if (starts_identifier && p - identifier > 2 &&
+        identifier[1] == (identifier[0] == 'g' ? 'l' : 'L')) {
+      word.assign(identifier, p);
+      identifiers->insert(word);
+    }
+  }
+}
+
+bool isSourceFileName(const std::string &name) {
+  static const char *kExtensions[] = {
+    ".c", ".cc", ".cpp", ".cxx", ".h", ".hh", ".hpp", ".hxx", ".inl", ".m",
+    ".mm"
+  };
+  for (const char *extension : kExtensions) {
+    size_t length = strlen(extension);
+    if (name.size() > length &&
+        name.compare(name.size() - length, length, extension) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the absolute path of an existing file without symbolic links, or an
+// empty string if the path does not exist.
+std::string canonicalPath(const std::string &path) {
+#if defined(GALOGEN_HAS_DIRENT)
+  char resolved[PATH_MAX];
+  if (realpath(path.c_str(), resolved) != nullptr) {
+    return resolved;
+  }
+#endif
+  return std::string();
+}
+
+// A source file found by listSourceFiles().
+struct SourceFile {
+  std::string path;
+  uint64_t size;
+
+  // Nanoseconds since the epoch (see modificationTime()).
+  uint64_t mtime;
+};
+
+// Appends all source files under `directory` to `files`. Symbolic links to
+// directories are not followed, and directories whose names start with '.'
+// (such as .git) are skipped. Returns false and sets `*error` if a directory
+// can not be read.
+bool listSourceFiles(const std::string &directory,
+                     std::vector<SourceFile> *files,
+                     std::string *error) {
+#if defined(GALOGEN_HAS_DIRENT)
+  DIR *dir = opendir(directory.c_str());
+  if (dir == nullptr) {
+    *error = "Failed to read directory " + directory;
+    return false;
+  }
+  std::vector<std::string> subdirectories;
+  while (struct dirent *entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.empty() || name[0] == '.') {
+      continue;
+    }
+    std::string path = directory + "/" + name;
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      subdirectories.push_back(path);
+    } else if (isSourceFileName(name) &&
+               (S_ISREG(st.st_mode) ||
+                (S_ISLNK(st.st_mode) && stat(path.c_str(), &st) == 0 &&
+                 S_ISREG(st.st_mode)))) {
+      files->push_back(
+          {path, (uint64_t)st.st_size, modificationTime(st)});
+    }
+  }
+  closedir(dir);
+  // Sorted, so that the result does not depend on the order of entries on
+  // disk.
+  std::sort(subdirectories.begin(), subdirectories.end());
+  for (const std::string &subdirectory : subdirectories) {
+    if (!listSourceFiles(subdirectory, files, error)) {
+      return false;
+    }
+  }
+  return true;
+#else
+  *error = "Scanning directories is not supported on this platform";
+  return false;
+#endif
+}
+
+// Identifiers used by each source file, kept in a file between runs (see
+// --usage-cache) so that later scans only read the files that changed. A file
+// is taken to be unchanged if its size and modification time are the ones
+// recorded in the index, unless it was modified shortly before the previous
+// scan: on file systems with coarse timestamps, it may have been written again
+// after it was read without its modification time changing. Files that look
+// changed are hashed, and only scanned again if the hash differs, so touching
+// a file costs a read but no scan. For every identifier, the index counts the
+// files that use it, which lets the union over all files be updated with the
+// changes of each scan instead of being recomputed.
+//
+// The index file has the snapshot layout (see SnapshotWriter). Its word stream
+// holds the start time of the last scan and the number of files, followed by
+// the path, size, modification time, hash and identifiers of each file.
+class UsageIndex {
+public:
+  explicit UsageIndex(const std::string &path) : path_(path) {}
+
+  std::mutex& mutex() { return mutex_; }
+
+  // Brings the index up to date with `files`, the complete list of files to
+  // scan. New and changed files are read on up to `jobs` threads, and files
+  // that are no longer listed are dropped. Reads the index file on first use.
+  // Returns false and sets `*error` if a file can not be read. Must be called
+  // with mutex() locked.
+  bool update(const std::vector<SourceFile> &files,
+              unsigned jobs,
+              std::string *error,
+              Timings *timings) {
+    if (!loaded_) {
+      ScopedTimer timer(timings, "usage: read index");
+      load();
+      loaded_ = true;
+    }
+    uint64_t scan_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    std::vector<Symbol> paths(files.size());
+    // Indices of the files that have to be read.
+    std::vector<size_t> changed;
+    {
+      ScopedTimer timer(timings, "usage: check files");
+      std::unordered_set<Symbol, SymbolHash> listed;
+      listed.reserve(files.size());
+      for (size_t i = 0; i < files.size(); ++i) {
+        paths[i] = symbols_.intern(files[i].path);
+        listed.insert(paths[i]);
+        auto it = files_.find(paths[i]);
+        if (it == files_.end() ||
+            it->second.size != files[i].size ||
+            it->second.mtime != files[i].mtime ||
+            files[i].mtime + kTimestampGranularity >= scan_time_) {
+          changed.push_back(i);
+        }
+      }
+      for (auto it = files_.begin(); it != files_.end();) {
+        if (listed.count(it->first) == 0) {
+          removeUses(it->second.identifiers);
+          it = files_.erase(it);
+          dirty_ = true;
+        } else {
+          ++it;
+        }
+      }
+    }
+    ScopedTimer timer(timings, "usage: scan files");
+    std::vector<uint64_t> hashes(changed.size());
+    std::vector<char> rescanned(changed.size());
+    std::vector<std::unordered_set<std::string>> file_identifiers(
+        changed.size());
+    std::vector<std::string> errors(changed.size());
+    runParallel(changed.size(), jobs, [&](size_t i) {
+      const SourceFile &source = files[changed[i]];
+      MappedFile file;
+      if (!file.open(source.path.c_str())) {
+        errors[i] = "Failed to read " + source.path;
+        return;
+      }
+      hashes[i] = hashBytes(file.data(), file.size());
+      auto it = files_.find(paths[changed[i]]);
+      if (it == files_.end() || it->second.hash != hashes[i]) {
+        rescanned[i] = true;
+        scanIdentifiers(file.data(),
+                        file.data() + file.size(),
+                        &file_identifiers[i]);
+      }
+    });
+    for (const std::string &file_error : errors) {
+      if (!file_error.empty()) {
+        *error = file_error;
+        return false;
+      }
+    }
+    for (size_t i = 0; i < changed.size(); ++i) {
+      const SourceFile &source = files[changed[i]];
+      FileEntry &entry = files_[paths[changed[i]]];
+      if (rescanned[i]) {
+        removeUses(entry.identifiers);
+        entry.identifiers.clear();
+        for (const std::string &identifier : file_identifiers[i]) {
+          entry.identifiers.push_back(symbols_.intern(identifier));
+        }
+        addUses(entry.identifiers);
+      }
+      entry.size = source.size;
+      entry.mtime = source.mtime;
+      entry.hash = hashes[i];
+    }
+    // Files that were read are recorded with a new scan time, even if they
+    // did not change, so that they are not read again next time.
+    dirty_ = dirty_ || !changed.empty();
+    scan_time_ = scan_time;
+    return true;
+  }
+
+  // Adds the identifiers used by any file in the index to `identifiers`.
+  void identifiers(std::unordered_set<std::string> *identifiers) const {
+    identifiers->reserve(identifiers->size() + file_counts_.size());
+    for (const auto &count : file_counts_) {
+      identifiers->insert(count.first.str());
+    }
+  }
+
+  // Writes the index file unless it is up to date. Returns false if it can
+  // not be written.
+  bool save() {
+    if (!dirty_) {
+      return true;
+    }
+    SnapshotWriter w;
+    w.putUint64(scan_time_);
+    w.putWord((uint32_t)files_.size());
+    for (const auto &file : files_) {
+      w.putString(file.first);
+      w.putUint64(file.second.size);
+      w.putUint64(file.second.mtime);
+      w.putUint64(file.second.hash);
+      w.putWord((uint32_t)file.second.identifiers.size());
+      for (Symbol identifier : file.second.identifiers) {
+        w.putString(identifier);
+      }
+    }
+    if (!w.save(path_, kUsageIndexMagic, kUsageIndexFormatVersion, 0)) {
+      return false;
+    }
+    dirty_ = false;
+    return true;
+  }
+
+private:
+  struct FileEntry {
+    uint64_t size = 0;
+    uint64_t mtime = 0;
+    uint64_t hash = 0;
+    std::vector<Symbol> identifiers;
+  };
+
+  // Files modified less than this long (in nanoseconds) before a scan started
+  // are read again by the next scan. Covers the 2 second timestamps of FAT.
+  static const uint64_t kTimestampGranularity = 2000000000ull;
+
+  static const char kUsageIndexMagic[8];
+  static const uint32_t kUsageIndexFormatVersion = 1;
+
+  // Reads the index file. If it does not exist or is damaged, the index is
+  // left empty, and every file is scanned.
+  void load() {
+    std::unique_ptr<MappedFile> file(new MappedFile());
+    SnapshotHeader header;
+    if (!openSnapshotFile(path_,
+                          kUsageIndexMagic,
+                          kUsageIndexFormatVersion,
+                          0,
+                          file.get(),
+                          &header)) {
+      return;
+    }
+    const char *blob = file->data() + sizeof(header);
+    SymbolTable symbols;
+    SnapshotReader r(blob, header.blob_size,
+                     blob + header.blob_size, header.word_count,
+                     &symbols);
+    if (!r.adoptStrings(header.string_count)) {
+      return;
+    }
+    uint64_t scan_time = r.getUint64();
+    std::unordered_map<Symbol, FileEntry, SymbolHash> files;
+    for (uint32_t i = 0, count = r.getCount(); i < count; ++i) {
+      FileEntry &entry = files[r.getString()];
+      entry.size = r.getUint64();
+      entry.mtime = r.getUint64();
+      entry.hash = r.getUint64();
+      entry.identifiers.resize(r.getCount());
+      for (Symbol &identifier : entry.identifiers) {
+        identifier = r.getString();
+      }
+    }
+    if (!r.ok() || !r.atEnd()) {
+      return;
+    }
+    symbols_ = std::move(symbols);
+    file_ = std::move(file);
+    files_ = std::move(files);
+    scan_time_ = scan_time;
+    for (const auto &entry : files_) {
+      addUses(entry.second.identifiers);
+    }
+  }
+
+  void addUses(const std::vector<Symbol> &identifiers) {
+    for (Symbol identifier : identifiers) {
+      ++file_counts_[identifier];
+    }
+  }
+
+  void removeUses(const std::vector<Symbol> &identifiers) {
+    for (Symbol identifier : identifiers) {
+      auto it = file_counts_.find(identifier);
+      if (--it->second == 0) {
+        file_counts_.erase(it);
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::string path_;
+  bool loaded_ = false;
+
+  // Whether the index differs from the index file.
+  bool dirty_ = false;
+
+  // Holds the strings adopted by `symbols_` from the index file.
+  std::unique_ptr<MappedFile> file_;
+  SymbolTable symbols_;
+  std::unordered_map<Symbol, FileEntry, SymbolHash> files_;
+
+  // Number of files using each identifier. Only identifiers used by at least
+  // one file are present.
+  std::unordered_map<Symbol, uint32_t, SymbolHash> file_counts_;
+
+  // Start time of the last scan, in nanoseconds since the epoch.
+  uint64_t scan_time_ = 0;
+};
+
+const char UsageIndex::kUsageIndexMagic[8] = {
+  'G', 'A', 'L', 'O', 'G', 'E', 'N', 'U'
+};
+
+// Returns the index stored in the given file. Indexes stay loaded for the rest
+// of the process, so later targets of a batch and later server requests do not
+// read the file again.
+UsageIndex* usageIndex(const std::string &path) {
+  static std::mutex mutex;
+  static std::unordered_map<std::string, std::unique_ptr<UsageIndex>> indexes;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::unique_ptr<UsageIndex> &index = indexes[path];
+  if (index == nullptr) {
+    index.reset(new UsageIndex(path));
+  }
+  return index.get();
+}
+
+// Returns the part of a path after the last '/'.
+std::string baseName(const std::string &path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// Collects the identifiers starting with "gl" or "GL" that occur in the C, C++
+// and Objective-C sources under the given directories into `identifiers`.
+// Files are read on up to `jobs` threads (all hardware threads if 0). Files
+// listed in `excluded_files`, such as a previously generated loader, are
+// skipped. If `index_file_name` is not empty, only files that changed since
+// the index in that file was last updated are read (see UsageIndex); failing
+// to write the index is reported in `*warnings`, if not null. Returns false
+// and sets `*error` on failure.
+bool scanUsage(const std::vector<std::string> &directories,
+               const std::vector<std::string> &excluded_files,
+               unsigned jobs,
+               const std::string &index_file_name,
+               std::unordered_set<std::string> *identifiers,
+               std::string *error,
+               std::vector<std::string> *warnings,
+               Timings *timings) {
+  std::vector<SourceFile> files;
+  {
+    ScopedTimer timer(timings, "usage: list files");
+    for (const std::string &directory : directories) {
+      if (!listSourceFiles(directory, &files, error)) {
+        return false;
+      }
+    }
+    std::unordered_set<std::string> excluded;
+    // Only files with these names are resolved, since that takes a system
+    // call for every component of the path.
+    std::unordered_set<std::string> excluded_names;
+    for (const std::string &file : excluded_files) {
+      std::string path = canonicalPath(file);
+      if (!path.empty()) {
+        excluded.insert(path);
+        excluded_names.insert(baseName(path));
+      }
+    }
+    if (!excluded.empty()) {
+      files.erase(std::remove_if(files.begin(),
+                                 files.end(),
+                                 [&](const SourceFile &file) {
+                                   return excluded_names.count(
+                                              baseName(file.path)) > 0 &&
+                                          excluded.count(
+                                              canonicalPath(file.path)) > 0;
+                                 }),
+                  files.end());
+    }
+  }
+  if (!index_file_name.empty()) {
+    UsageIndex *index = usageIndex(index_file_name);
+    std::lock_guard<std::mutex> lock(index->mutex());
+    if (!index->update(files, jobs, error, timings)) {
+      return false;
+    }
+    {
+      ScopedTimer timer(timings, "usage: write index");
+      if (!index->save() && warnings != nullptr) {
+        warnings->push_back("failed to write usage index " + index_file_name);
+      }
+    }
+    ScopedTimer timer(timings, "usage: collect identifiers");
+    index->identifiers(identifiers);
+    return true;
+  }
+  ScopedTimer timer(timings, "usage: scan files");
+  std::vector<std::unordered_set<std::string>> file_identifiers(files.size());
+  std::vector<std::string> errors(files.size());
+  runParallel(files.size(), jobs, [&](size_t i) {
+    MappedFile file;
+    if (!file.open(files[i].path.c_str())) {
+      errors[i] = "Failed to read " + files[i].path;
+      return;
+    }
+    scanIdentifiers(file.data(),
+                    file.data() + file.size(),
+                    &file_identifiers[i]);
+  });
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (!errors[i].empty()) {
+      *error = errors[i];
+      return false;
+    }
+    identifiers->insert(file_identifiers[i].begin(),
+                        file_identifiers[i].end());
+  }
+  return true;
+}
+
+// Removes the commands and enumerants whose names are not in `used` from
+// `entity_sets`, and the groups that are not referenced by the remaining
+// commands. An entity is also kept if it is an alias of a used entity, or if
+// a used entity is an alias of it, since programs may use either name and the
+// generated files define one in terms of the other. Types are kept: they cost
+// nothing at run time, and the loader itself needs the basic ones (e.g. glx.h
+// uses GLubyte). Returns false and sets `*error` if a command can not be
+// parsed. Must be called with registry->mutex locked.
+bool pruneUnusedEntities(Registry *registry,
+                         ApiView *view,
+                         Symbol api,
+                         const std::unordered_set<std::string> &used,
+                         EntityBitsets *entity_sets,
+                         std::string *error) {
+  EntityBitsets used_sets;
+  for (const std::string &identifier : used) {
+    Symbol name = registry->symbols.find(identifier);
+    if (name.empty()) {
+      continue;
+    }
+    for (EntityKind kind : {EntityKind::kEnum, EntityKind::kCommand}) {
+      const EntityIds &ids = registry->entity_ids[kind];
+      auto id_it = ids.ids.find(name);
+      if (id_it != ids.ids.end()) {
+        used_sets[kind].insert(id_it->second);
+      }
+    }
+  }
+  EntityBitsets &sets = *entity_sets;
+  bool ok = true;
+  for (EntityKind kind : {EntityKind::kEnum, EntityKind::kCommand}) {
+    const EntityIds &ids = registry->entity_ids[kind];
+    EntityBitset &used_ids = used_sets[kind];
+    // Pairs of an entity of the target or a used entity, and the entity it is
+    // an alias of.
+    std::vector<std::pair<uint32_t, uint32_t>> aliases;
+    EntityBitset candidates = sets[kind];
+    candidates.insertAll(used_ids);
+    candidates.forEach([&](uint32_t id) {
+      Symbol alias;
+      if (kind == EntityKind::kEnum) {
+        const EnumerantInfo *enumerant = findDefinition(view->enums, id);
+        alias = enumerant != nullptr ? enumerant->alias : Symbol();
+      } else if (ok) {
+        // Used commands outside the target need not exist for the API.
+        bool in_target = sets[kind].contains(id);
+        std::string lookup_error;
+        const CommandInfo *command = resolveCommandLocked(
+            registry, view, api, id, in_target ? error : &lookup_error);
+        if (command == nullptr) {
+          ok = !in_target;
+          return;
+        }
+        alias = command->alias;
+      }
+      if (alias.empty()) {
+        return;
+      }
+      auto alias_it = ids.ids.find(alias);
+      if (alias_it != ids.ids.end()) {
+        aliases.emplace_back(id, alias_it->second);
+      } else if (used.count(alias.str()) > 0) {
+        used_ids.insert(id);
+      }
+    });
+    // Repeated until nothing changes, to follow chains of aliases.
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (const auto &alias : aliases) {
+        bool entity_used = used_ids.contains(alias.first);
+        if (entity_used != used_ids.contains(alias.second)) {
+          used_ids.insert(entity_used ? alias.second : alias.first);
+          changed = true;
+        }
+      }
+    }
+  }
+  if (!ok) {
+    return false;
+  }
+  sets[EntityKind::kCommand].retainAll(used_sets[EntityKind::kCommand]);
+  sets[EntityKind::kEnum].retainAll(used_sets[EntityKind::kEnum]);
+  EntityIds &group_ids = registry->entity_ids[EntityKind::kGroup];
+  EntityBitset &used_groups = used_sets[EntityKind::kGroup];
+  sets[EntityKind::kCommand].forEach([&](uint32_t id) {
+    const CommandInfo *command =
+        ok ? resolveCommandLocked(registry, view, api, id, error) : nullptr;
+    if (command == nullptr) {
+      ok = false;
+      return;
+    }
+    for (const CommandInfo::ParamInfo &param : command->parameters) {
+      if (!param.group.empty()) {
+        used_groups.insert(group_ids.get(param.group));
+      }
+    }
+  });
+  sets[EntityKind::kGroup].retainAll(used_groups);
+  return ok;
+}
+
+// The entities that make up a target, grouped by kind and ordered by ID, and
+// their definitions for the target's API.
+struct EntityLists {
+  PerEntityKind<std::vector<uint32_t>> ids;
+
+  // names[kind][i] is the name of the entity ids[kind][i].
+  PerEntityKind<std::vector<Symbol>> names;
+
+  const ApiView *view = nullptr;
+};
+
+// Computes the entities making up the given version of an API profile, plus
+// the given extensions. If `used_identifiers` is not null, only the entities
+// used by a program with these identifiers are kept (see
+// pruneUnusedEntities()). Returns false and sets `*error` if the registry
+// contents are inconsistent. Safe to call concurrently on the same registry.
+bool resolveEntities(const Registry &registry,
+                     Symbol api,
+                     Symbol profile,
+                     const ApiVersion &api_version,
+                     const std::vector<const ExtensionInfo*> &extensions,
+                     const std::unordered_set<std::string> *used_identifiers,
+                     EntityLists *entities,
+                     std::string *error,
+                     Timings *timings) {
+  std::unique_lock<std::mutex> lock(*registry.mutex, std::defer_lock);
+  {
+    ScopedTimer timer(timings, "resolve: wait for registry");
+    lock.lock();
+  }
+  // Compiled operations and feature levels are cached in the registry, which
+  // is why a const registry may be modified here (under the lock).
+  Registry *mutable_registry = const_cast<Registry*>(&registry);
+  ApiView *view = findApiView(mutable_registry, api, timings);
+  const FeatureLevels *levels =
+      findFeatureLevels(mutable_registry, api, profile, error, timings);
+  if (levels == nullptr) {
+    return false;
+  }
+  size_t level_count = 0;
+  while (level_count < levels->versions.size() &&
+         !(levels->versions[level_count] > api_version)) {
+    ++level_count;
+  }
+  EntityBitsets entity_sets;
+  if (level_count > 0) {
+    entity_sets = levels->entities[level_count - 1];
+  }
+  {
+    ScopedTimer timer(timings, "resolve: apply extensions");
+    for (const ExtensionInfo *extension : extensions) {
+      if (!applyOperations(mutable_registry,
+                           api,
+                           profile,
+                           extension->operations,
+                           entity_sets,
+                           error)) {
+        return false;
+      }
+    }
+  }
+  if (used_identifiers != nullptr) {
+    ScopedTimer timer(timings, "resolve: prune unused entities");
+    if (!pruneUnusedEntities(mutable_registry,
+                             view,
+                             api,
+                             *used_identifiers,
+                             &entity_sets,
+                             error)) {
+      return false;
+    }
+  }
+  ScopedTimer timer(timings, "resolve: list entities");
+  for (size_t kind = 0; kind < kEntityKindCount; ++kind) {
+    EntityKind entity_kind = (EntityKind)kind;
+    const std::vector<Symbol> &names = registry.entity_ids[entity_kind].names;
+    std::vector<uint32_t> &ids = entities->ids[entity_kind];
+    std::vector<Symbol> &id_names = entities->names[entity_kind];
+    entity_sets[entity_kind].forEach([&](uint32_t id) {
+      ids.push_back(id);
+      id_names.push_back(names[id]);
+    });
+  }
+  // Lazily loaded commands are parsed here, while the lock is held, so that
+  // their entries can be read without it. Errors are reported when the
+  // target is generated.
+  std::string command_error;
+  for (uint32_t id : entities->ids[EntityKind::kCommand]) {
+    resolveCommandLocked(mutable_registry, view, api, id, &command_error);
+  }
+  entities->view = view;
+  return true;
+}
+
+// Forwards calls to another generator, adding the time spent in each
+// callback to a Timings object and counting the emitted entities in a
+// RunStats object. Either of them may be null.
+class InstrumentedOutputGenerator : public OutputGenerator {
+public:
+  InstrumentedOutputGenerator(OutputGenerator *generator,
+                              Timings *timings,
+                              RunStats *stats) :
+      generator_(generator), timings_(timings), stats_(stats) {}
+
+  void start(const std::string &name,
+             const std::string &api_name,
+             const std::string &profile,
+             int api_ver_maj,
+             int api_ver_min) override {
+    ScopedTimer timer(timings_, "output: start");
+    generator_->start(name, api_name, profile, api_ver_maj, api_ver_min);
+  }
+
+  void processType(const TypeInfo &type) override {
+    ScopedTimer timer(timings_, "output: processType");
+    generator_->processType(type);
+    count(&RunStats::types_emitted);
+  }
+
+  void processEnumGroup(const GroupInfo &group) override {
+    ScopedTimer timer(timings_, "output: processEnumGroup");
+    generator_->processEnumGroup(group);
+    count(&RunStats::groups_emitted);
+  }
+
+  void processEnumerant(const EnumerantInfo &enumerant) override {
+    ScopedTimer timer(timings_, "output: processEnumerant");
+    generator_->processEnumerant(enumerant);
+    count(&RunStats::enums_emitted);
+  }
+
+  void processCommand(const CommandInfo &command) override {
+    ScopedTimer timer(timings_, "output: processCommand");
+    generator_->processCommand(command);
+    count(&RunStats::commands_emitted);
+  }
+
+  void end() override {
+    ScopedTimer timer(timings_, "output: end");
+    generator_->end();
+    if (stats_ != nullptr) {
+      ++stats_->targets;
+      stats_->header_bytes += generator_->headerBytes();
+      stats_->source_bytes += generator_->sourceBytes();
+    }
+  }
+
+private:
+  void count(std::atomic<uint64_t> RunStats::*counter) {
+    if (stats_ != nullptr) {
+      ++(stats_->*counter);
+    }
+  }
+
+  OutputGenerator *generator_;
+  Timings *timings_;
+  RunStats *stats_;
+};
+
+// Generates output for a single target, handing the generated files to
+// `sink`. The registry is not modified, so multiple targets may be generated
+// from the same registry concurrently. Returns false and sets `*error` on
+// failure. If `timings` is not null, the time spent in each step is added to
+// it. If `stats` is not null, the emitted entities and output sizes are added
+// to it.
+bool generate(const Registry &registry,
+              const GenerationOptions &options,
+              OutputGenerator *generator,
+              OutputSink *sink,
+              std::string *error,
+              std::vector<std::string> *warnings = nullptr,
+              Timings *timings = nullptr,
+              RunStats *stats = nullptr) {
+  generator->setOutputSink(sink);
+  OutputGenerator *target_generator = generator;
+  InstrumentedOutputGenerator instrumented_generator(generator, timings, stats);
+  if (timings != nullptr || stats != nullptr) {
+    generator = &instrumented_generator;
+  }
+  const EntityMap<TypeInfo> &type_map = registry.types;
+  const EntityMap<EnumerantInfo> &enum_map = registry.enums;
+  const EntityMap<GroupInfo> &group_map = registry.groups;
+  const Symbol api = findSymbol(registry, options.api_name);
+  const Symbol profile = findSymbol(registry, options.profile);
+
+  // Process extensions.
+  ScopedTimer match_timer(timings, "generate: match extensions");
+  std::vector<const ExtensionInfo*> extensions;
+  std::unordered_set<std::string> remaining_extensions(options.extensions);
+  EntitySet requested_extensions;
+  for (const std::string &extension_name : options.extensions) {
+    Symbol extension_symbol = findSymbol(registry, extension_name);
+    if (!extension_symbol.empty()) {
+      requested_extensions.insert(extension_symbol);
+    }
+  }
+  const uint64_t api_bit = findApiBit(registry, options.api_name);
+  for (const ExtensionInfo &extension : registry.extensions) {
+    Symbol extension_name = extension.name;
+    bool extension_supported = (extension.supported_apis & api_bit) != 0;
+    bool extension_requested = requested_extensions.count(extension_name) >= 1;
+    if (extension_requested && extension_supported) {
+      extensions.push_back(&extension);
+      remaining_extensions.erase(extension_name.str());
+    } else if (extension_requested && warnings != nullptr) {
+      warnings->push_back(formatMessage(
+          "extension %s requested, but not supported by API %s",
+          extension_name.c_str(), options.api_name.c_str()));
+    }
+  }
+  match_timer.stop();
+  // Checked before anything else, so that invalid requests are rejected
+  // without scanning usage directories.
+  std::vector<std::string> sorted_remaining_extensions(
+      remaining_extensions.begin(), remaining_extensions.end());
+  std::sort(sorted_remaining_extensions.begin(),
+            sorted_remaining_extensions.end());
+  std::ostringstream invalid_extensions;
+  std::copy(sorted_remaining_extensions.begin(),
+            sorted_remaining_extensions.end(),
+            std::ostream_iterator<std::string>(invalid_extensions, ", "));
+  if (!invalid_extensions.str().empty()) {
+    *error = "Invalid extensions specified: " + invalid_extensions.str();
+    return false;
+  }
+  std::unordered_set<std::string> used_identifiers;
+  if (!options.usage_dirs.empty() &&
+      !scanUsage(options.usage_dirs,
+                 {options.filename + ".h", options.filename + ".c"},
+                 options.jobs,
+                 options.usage_cache_file_name,
+                 &used_identifiers,
+                 error,
+                 warnings,
+                 timings)) {
+    return false;
+  }
+  EntityLists entity_lists;
+  if (!resolveEntities(registry,
+                       api,
+                       profile,
+                       options.api_version,
+                       extensions,
+                       options.usage_dirs.empty() ? nullptr : &used_identifiers,
+                       &entity_lists,
+                       error,
+                       timings)) {
+    return false;
+  }
+  // The output must only depend on the registry contents and the options, so
+  // that identical inputs produce identical files with any toolchain. Each
+  // kind of entity is emitted in registry (i.e. ID) order, except that types
+  // are emitted after the types they require.
+  generator->start(options.filename, options.api_name, options.profile,
+                   options.api_version.maj(),
+                   options.api_version.min());
+  // Entities are looked up in the API's view by ID; only entities that have
+  // no entry there are looked up by name, which reports the errors.
+  const ApiView &view = *entity_lists.view;
+  ScopedTimer types_timer(timings, "generate: types");
+  std::unordered_set<const TypeInfo*> processed_types;
+  std::function<bool(Symbol)> output_type;
+  auto output_type_info = [&](const TypeInfo *info) {
+    if (!processed_types.insert(info).second) {
+      return true;
+    }
+    if (!info->prerequisite_type.empty() &&
+        !output_type(info->prerequisite_type)) {
+      return false;
+    }
+    generator->processType(*info);
+    return true;
+  };
+  output_type = [&](Symbol type_name) {
+    auto type_it = type_map.find(type_name);
+    if (type_it == type_map.end()) {
+      *error = "Reference to undefined type " + type_name.str();
+      return false;
+    }
+    const TypeInfo *info = type_it->second.get(api);
+    if (info == nullptr) {
+      *error = "Couldn't find type for api " + options.api_name;
+      return false;
+    }
+    return output_type_info(info);
+  };
+
+  // KLUDGE: GLDEBUGPROC depends on these types but doesn't declare them as
+  //         dependencies in any visible way. So force-output them at the very
+  //         beginning.
+  //         See https://github.com/KhronosGroup/OpenGL-Registry/issues/160
+  for (const char *type_name : {"GLenum", "GLuint", "GLsizei", "GLchar"}) {
+    Symbol type_symbol = findSymbol(registry, type_name);
+    if (type_symbol.empty()) {
+      *error = std::string("Reference to undefined type ") + type_name;
+      return false;
+    }
+    if (!output_type(type_symbol)) {
+      return false;
+    }
+  }
+ 
+  const std::vector<uint32_t> &types = entity_lists.ids[EntityKind::kType];
+  for (size_t i = 0; i < types.size(); ++i) {
+    const TypeInfo *info = findDefinition(view.types, types[i]);
+    bool output = info != nullptr ?
+        output_type_info(info) :
+        output_type(entity_lists.names[EntityKind::kType][i]);
+    if (!output) {
+      return false;
+    }
+  }
+  types_timer.stop();
+
+  ScopedTimer groups_timer(timings, "generate: groups");
+  const std::vector<uint32_t> &groups = entity_lists.ids[EntityKind::kGroup];
+  for (size_t i = 0; i < groups.size(); ++i) {
+    const GroupInfo *resolved_info = findDefinition(view.groups, groups[i]);
+    if (resolved_info != nullptr) {
+      generator->processEnumGroup(*resolved_info);
+      continue;
+    }
+    Symbol group_name = entity_lists.names[EntityKind::kGroup][i];
+    auto group_it = group_map.find(group_name);
+    if(group_it == group_map.end()) {
+      // It is not an error to refer to a group that had not been defined
+      // before (see readme section 7.3).
+      continue;
+    }
+    const GroupInfo *info = group_it->second.get(api);
+    if (info == nullptr) {
+      *error = formatMessage("Failed to find group %s for api %s",
+                             group_name.c_str(),
+                             options.api_name.c_str());
+      return false;
+    }
+    GroupInfo resolved_group = *info;
+    for (Symbol enum_name : info->enum_names) {
+      auto enum_it = enum_map.find(enum_name);
+      if (enum_it == enum_map.end()) {
+        *error = formatMessage("Reference to undefined enum %s in group %s",
+                               enum_name.c_str(),
+                               group_name.c_str());
+        return false;
+      }
+      const EnumerantInfo *enum_info = enum_it->second.get(api);
+      if (enum_info == nullptr) {
+        *error = formatMessage("Failed to find enum %s for api %s",
+                               enum_name.c_str(),
+                               options.api_name.c_str());
+        return false;
+      }
+      resolved_group.enums.push_back(enum_info);
+    }
+    generator->processEnumGroup(resolved_group);
+  }
+  groups_timer.stop();
+
+  ScopedTimer enums_timer(timings, "generate: enums");
+  const std::vector<uint32_t> &enums = entity_lists.ids[EntityKind::kEnum];
+  for (size_t i = 0; i < enums.size(); ++i) {
+    const EnumerantInfo *info = findDefinition(view.enums, enums[i]);
+    if (info != nullptr) {
+      generator->processEnumerant(*info);
+      continue;
+    }
+    Symbol enum_name = entity_lists.names[EntityKind::kEnum][i];
+    auto enum_it = enum_map.find(enum_name);
+    if (enum_it == enum_map.end()) {
+      *error = "Reference to undefined enumerant " + enum_name.str();
+      return false;
+    }
+    info = enum_it->second.get(api);
+    if (info == nullptr) {
+      *error = formatMessage("Failed to find enumerant %s for api %s",
+                             enum_name.c_str(),
+                             options.api_name.c_str());
+      return false;
+    }
+    generator->processEnumerant(*info);
+  }
+  enums_timer.stop();
+ 
+  ScopedTimer commands_timer(timings, "generate: commands");
+  const std::vector<uint32_t> &commands =
+      entity_lists.ids[EntityKind::kCommand];
+  for (size_t i = 0; i < commands.size(); ++i) {
+    const CommandInfo *info = findDefinition(view.commands, commands[i]);
+    if (info != nullptr) {
+      generator->processCommand(*info);
+      continue;
+    }
+    Symbol command_name = entity_lists.names[EntityKind::kCommand][i];
+    const ApiEntity<CommandInfo> *command =
+        findCommand(registry, command_name, error);
+    if (command == nullptr) {
+      return false;
+    }
+    info = command->get(api);
+    if (info == nullptr) {
+      *error = formatMessage("Failed to find command %s for api %s",
+                             command_name.c_str(),
+                             options.api_name.c_str());
+      return false;
+    }
+    generator->processCommand(*info);
+  }
+  commands_timer.stop();
+  generator->end();
+  if (!target_generator->error().empty()) {
+    *error = target_generator->error();
+    return false;
+  }
+  return true;
+}
+
+extern const char *help_message;
+
+// Maps generator names to functions creating new instances of generators.
+using GeneratorMap =
+    std::unordered_map<std::string,
+                       std::function<std::unique_ptr<OutputGenerator>()>>;
+
+void createGenerators(GeneratorMap &g);
+
+// Outcome of applyTargetOption().
+enum class OptionResult {
+  kApplied,
+  kInvalid,
+  // Not an option that describes a target.
+  kUnknown
+};
+
+// Applies one of the options that describe a single target, as given on the
+// command line, in a batch manifest or in a server request. Sets `*error` if
+// the value is invalid. Sets `*api_ver_specified` if the option is the API
+// version.
+OptionResult applyTargetOption(const std::string &arg,
+                               const std::string &value,
+                               const GeneratorMap &generators,
+                               GenerationOptions *options,
+                               bool *api_ver_specified,
+                               std::string *error) {
+  if (arg == "--api") {
+    if (value != "gl" && value != "gles2" &&
+        value != "gles1" && value != "glsc2") {
+      *error = "Invalid API name " + value;
+      return OptionResult::kInvalid;
+    }
+    options->api_name = value;
+  } else if (arg == "--ver") {
+    *api_ver_specified = true;
+    options->api_version = ApiVersion(value.c_str());
+    if (!options->api_version.valid()) {
+      *error = "Invalid version \"" + value + "\"";
+      return OptionResult::kInvalid;
+    }
+  } else if (arg == "--profile") {
+    if (value != "core" && value != "compatibility") {
+      *error = "Profile must be either \"core\" or \"compatibility\"";
+      return OptionResult::kInvalid;
+    }
+    options->profile = value;
+  } else if (arg == "--filename") {
+    options->filename = value;
+  } else if (arg == "--generator") {
+    if (generators.count(value) == 0) {
+      *error = "Invalid generator \"" + value + "\" specified.";
+      return OptionResult::kInvalid;
+    }
+    options->generator_name = value;
+  } else if (arg == "--exts") {
+    std::istringstream stream(value);
+    std::string extension_name;
+    while (std::getline(stream, extension_name, ',')) {
+      options->extensions.insert("GL_" + extension_name);
+    }
+  } else if (arg == "--usage-dirs") {
+    std::istringstream stream(value);
+    std::string directory;
+    options->usage_dirs.clear();
+    while (std::getline(stream, directory, ',')) {
+      if (!directory.empty()) {
+        options->usage_dirs.push_back(directory);
+      }
+    }
+  } else if (arg == "--usage-cache") {
+    options->usage_cache_file_name = value;
+  } else {
+    return OptionResult::kUnknown;
+  }
+  return OptionResult::kApplied;
+}
+
+// Parses command line options (everything after the registry file name) into
+// `options`. Options that configure the whole run rather than a single target
+// are rejected if `in_manifest` is true. Sets `*api_ver_specified` if the API
+// version was given explicitly.
+void parseOptions(const std::vector<std::string> &args,
+                  const GeneratorMap &generators,
+                  bool in_manifest,
+                  GenerationOptions *options,
+                  bool *api_ver_specified) {
+  for (size_t i = 0; i < args.size(); ++i) {
+    const std::string &arg = args[i];
+    if (i + 1 >= args.size()) {
+      FAIL("Inavlid options\n");
+    }
+    const std::string &value = args[++i];
+    std::string error;
+    OptionResult result = applyTargetOption(arg,
+                                            value,
+                                            generators,
+                                            options,
+                                            api_ver_specified,
+                                            &error);
+    if (result == OptionResult::kInvalid) {
+      FAIL("%s\n", error.c_str());
+    } else if (result == OptionResult::kApplied) {
+      continue;
+    } else if (in_manifest) {
+      FAIL("Option %s is not allowed in a batch manifest\n", arg.c_str());
+    } else if (arg == "--cache") {
+      options->registry.snapshot_file_name = value;
+    } else if (arg == "--xml-parser") {
+      if (value == "streaming") {
+        options->registry.parser = XmlParser::kStreaming;
+      } else if (value == "tinyxml2") {
+        options->registry.parser = XmlParser::kTinyXml2;
+      } else if (value == "parallel") {
+        options->registry.parser = XmlParser::kParallel;
+      } else {
+        FAIL("XML parser must be \"streaming\", \"tinyxml2\" or"
+             " \"parallel\"\n");
+      }
+    } else if (arg == "--lazy-commands") {
+      FAIL_IF(value != "yes" && value != "no",
+              "--lazy-commands must be either \"yes\" or \"no\"\n");
+      options->registry.lazy_commands = value == "yes";
+    } else if (arg == "--timings") {
+      if (value == "text") {
+        options->timings = ReportFormat::kText;
+      } else if (value == "json") {
+        options->timings = ReportFormat::kJson;
+      } else {
+        FAIL("Timings format must be either \"text\" or \"json\"\n");
+      }
+    } else if (arg == "--stats") {
+      if (value == "text") {
+        options->stats = ReportFormat::kText;
+      } else if (value == "json") {
+        options->stats = ReportFormat::kJson;
+      } else {
+        FAIL("Stats format must be either \"text\" or \"json\"\n");
+      }
+    } else if (arg == "--batch") {
+      options->batch_file_name = value;
+    } else if (arg == "--serve") {
+      FAIL_IF(value != "stdio" && value.compare(0, 5, "unix:") != 0,
+              "Server address must be either \"stdio\" or"
+              " \"unix:<socket path>\"\n");
+      options->serve_address = value;
+    } else if (arg == "--jobs") {
+      int jobs = atoi(value.c_str());
+      FAIL_IF(jobs <= 0, "Invalid number of jobs \"%s\"\n", value.c_str());
+      options->jobs = (unsigned)jobs;
+      options->registry.jobs = (unsigned)jobs;
+    } else {
+      FAIL("Unrecognized option: %s\n", arg.c_str());
+    }
+  }
+}
+
+void setDefaultApiVersion(GenerationOptions *options) {
+  const std::unordered_map<std::string, std::string> default_api_versions {
+    {"gl", "4.0"},
+    {"gles1", "1.0"},
+    {"gles2", "2.0"},
+    {"glsc2", "2.0"}
+  };
+  options->api_version =
+    ApiVersion(default_api_versions.find(options->api_name)->second.c_str());
+}
+
+// Reads the list of targets from a batch manifest. Each non-empty line of the
+// manifest that does not start with '#' describes one target, using the same
+// options as the command line, e.g.:
+//   --api gles2 --ver 3.0 --filename gles30
+// Options given on the command line serve as defaults for every target.
+void readManifest(const GenerationOptions &defaults,
+                  bool api_ver_specified,
+                  const GeneratorMap &generators,
+                  std::vector<GenerationOptions> *targets) {
+  std::ifstream manifest(defaults.batch_file_name);
+  FAIL_IF(!manifest, "Failed to open batch manifest %s\n",
+          defaults.batch_file_name.c_str());
+  std::unordered_set<std::string> filenames;
+  std::string line;
+  int line_num = 0;
+  while (std::getline(manifest, line)) {
+    ++line_num;
+    std::istringstream stream(line);
+    std::vector<std::string> args;
+    std::string arg;
+    while (stream >> arg) {
+      args.push_back(arg);
+    }
+    if (args.empty() || args[0][0] == '#') {
+      continue;
+    }
+    GenerationOptions target = defaults;
+    bool target_ver_specified = api_ver_specified;
+    parseOptions(args, generators, true, &target, &target_ver_specified);
+    if (!target_ver_specified) {
+      setDefaultApiVersion(&target);
+    }
+    FAIL_IF(!filenames.insert(target.filename).second,
+            "Duplicate file name \"%s\" on line %d of batch manifest %s\n",
+            target.filename.c_str(),
+            line_num,
+            defaults.batch_file_name.c_str());
+    targets->push_back(target);
+  }
+}
+
+// Prints the warnings returned by generate() to stderr.
+void printWarnings(const std::vector<std::string> &warnings) {
+  for (const std::string &warning : warnings) {
+    fprintf(stderr, "WARNING: %s\n", warning.c_str());
+  }
+}
+
+// Generates all targets from a single registry, writing the output files to
+// disk. A target that fails does not stop the others; once all are done, the
+// errors are printed in the order of the targets. Returns false if any target
+// failed.
+bool generateBatch(const Registry &registry,
+                   const std::vector<GenerationOptions> &targets,
+                   const GeneratorMap &generators,
+                   unsigned jobs,
+                   Timings *timings = nullptr,
+                   RunStats *stats = nullptr) {
+  std::vector<char> succeeded(targets.size());
+  std::vector<std::string> errors(targets.size());
+  runParallel(targets.size(), jobs, [&](size_t i) {
+    const GenerationOptions &target = targets[i];
+    std::unique_ptr<OutputGenerator> generator =
+        generators.at(target.generator_name)();
+    FileSink sink;
+    std::vector<std::string> warnings;
+    succeeded[i] = generate(registry,
+                            target,
+                            generator.get(),
+                            &sink,
+                            &errors[i],
+                            &warnings,
+                            timings,
+                            stats);
+    printWarnings(warnings);
+  });
+  bool ok = true;
+  for (size_t i = 0; i < targets.size(); ++i) {
+    if (succeeded[i]) {
+      printf("Generation finished successfully!\n");
+    } else {
+      fprintf(stderr, "FATAL ERROR: %s\n", errors[i].c_str());
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// Prints memory statistics, and the number of entities in the registry versus
+// the number that was emitted.
+void printStats(FILE *f,
+                ReportFormat format,
+                const Registry &registry,
+                const RunStats &stats) {
+  struct Row {
+    const char *name;
+    uint64_t value;
+  };
+  const Row rows[] = {
+    {"allocations", allocation_count.load()},
+    {"allocated_bytes", allocated_bytes.load()},
+    {"peak_rss_bytes", peakResidentSetSize()},
+    {"symbols", registry.symbols.size()},
+    {"symbol_bytes", registry.symbols.bytesReserved()},
+    {"types_loaded", registry.types.size()},
+    {"enums_loaded", registry.enums.size()},
+    {"groups_loaded", registry.groups.size()},
+    {"commands_loaded", registry.commands.size()},
+    {"commands_parsed",
+     registry.commands.size() - registry.unparsed_commands.size()},
+    {"features_loaded", registry.features.size()},
+    {"extensions_loaded", registry.extensions.size()},
+    {"targets", stats.targets.load()},
+    {"types_emitted", stats.types_emitted.load()},
+    {"enums_emitted", stats.enums_emitted.load()},
+    {"groups_emitted", stats.groups_emitted.load()},
+    {"commands_emitted", stats.commands_emitted.load()},
+    {"header_bytes", stats.header_bytes.load()},
+    {"source_bytes", stats.source_bytes.load()},
+  };
+  if (format == ReportFormat::kJson) {
+    fprintf(f, "{");
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); ++i) {
+      fprintf(f, "%s\n  \"%s\": %llu",
+              i == 0 ? "" : ",",
+              rows[i].name,
+              (unsigned long long)rows[i].value);
+    }
+    fprintf(f, "\n}\n");
+  } else {
+    for (const Row &row : rows) {
+      fprintf(f, "%-32s %12llu\n", row.name, (unsigned long long)row.value);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Server mode.
+//
+// With --serve, the registry is loaded once and targets are then generated on
+// request. Requests and responses are JSON objects, one per line, e.g.
+//   {"id": 7, "api": "gles2", "ver": "3.0", "exts": ["KHR_debug"],
+//    "filename": "out/gles30"}
+//   {"id": 7, "ok": true}
+// The keys "api", "ver", "profile", "exts", "generator", "filename",
+// "usage_dirs" and "usage_cache" take the same values as the corresponding
+// command line options ("exts" and "usage_dirs" may also be arrays); omitted
+// keys default to the values given on the command line.
+// "id" is optional and is echoed back, since requests are handled by a pool
+// of workers and responses may come back out of order.
+
+#if !defined(__EMSCRIPTEN__)
+
+// Value of a member of a JSON object.
+struct JsonValue {
+  enum class Kind { kString, kNumber, kLiteral, kArray };
+  Kind kind = Kind::kLiteral;
+
+  // Decoded string, or the text of a number or literal.
+  std::string text;
+
+  // Decoded strings, for arrays.
+  std::vector<std::string> items;
+
+  // The value as it appeared in the input.
+  std::string raw;
+};
+
+// Parser for the flat JSON objects used in server requests. Members may be
+// strings, numbers, true, false, null or arrays of strings.
+class JsonObjectParser {
+public:
+  explicit JsonObjectParser(const std::string &text) : text_(text) {}
+
+  bool parse(std::vector<std::pair<std::string, JsonValue>> *members,
+             std::string *error) {
+    skipWhitespace();
+    if (!expect('{')) {
+      return fail("expected '{'", error);
+    }
+    skipWhitespace();
+    if (!expect('}')) {
+      do {
+        skipWhitespace();
+        std::pair<std::string, JsonValue> member;
+        if (!parseString(&member.first)) {
+          return fail("expected a member name", error);
+        }
+        skipWhitespace();
+        if (!expect(':')) {
+          return fail("expected ':'", error);
+        }
+        skipWhitespace();
+        if (!parseValue(&member.second)) {
+          return fail("invalid value", error);
+        }
+        members->push_back(std::move(member));
+        skipWhitespace();
+      } while (expect(','));
+      if (!expect('}')) {
+        return fail("expected ',' or '}'", error);
+      }
+    }
+    skipWhitespace();
+    if (pos_ != text_.size()) {
+      return fail("unexpected text after the object", error);
+    }
+    return true;
+  }
+
+private:
+  bool fail(const char *message, std::string *error) {
+    *error = "Invalid JSON at offset " + std::to_string(pos_) + ": " + message;
+    return false;
+  }
+
+  void skipWhitespace() {
+    while (pos_ < text_.size() &&
+           (text_[pos_] == ' ' || text_[pos_] == '\t' ||
+            text_[pos_] == '\n' || text_[pos_] == '\r')) {
+      ++pos_;
+    }
+  }
+
+  bool expect(char c) {
+    if (pos_ < text_.size() && text_[pos_] == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  bool parseHex4(unsigned long *value) {
+    if (text_.size() - pos_ < 4) {
+      return false;
+    }
+    *value = 0;
+    for (int i = 0; i < 4; ++i) {
+      char c = text_[pos_++];
+      int digit = c >= '0' && c <= '9' ? c - '0' :
+                  c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                  c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+      if (digit < 0) {
+        return false;
+      }
+      *value = *value * 16 + (unsigned long)digit;
+    }
+    return true;
+  }
+
+  bool parseString(std::string *out) {
+    if (!expect('"')) {
+      return false;
+    }
+    while (pos_ < text_.size()) {
+      char c = text_[pos_++];
+      if (c == '"') {
+        return true;
+      } else if ((unsigned char)c < 0x20) {
+        return false;
+      } else if (c != '\\') {
+        out->push_back(c);
+        continue;
+      }
+      if (pos_ >= text_.size()) {
+        return false;
+      }
+      char escape = text_[pos_++];
+      switch (escape) {
+      case '"': case '\\': case '/': out->push_back(escape); break;
+      case 'b': out->push_back('\b'); break;
+      case 'f': out->push_back('\f'); break;
+      case 'n': out->push_back('\n'); break;
+      case 'r': out->push_back('\r'); break;
+      case 't': out->push_back('\t'); break;
+      case 'u': {
+        unsigned long code_point;
+        if (!parseHex4(&code_point)) {
+          return false;
+        }
+        if (code_point >= 0xD800 && code_point < 0xDC00) {
+          unsigned long low;
+          if (!expect('\\') || !expect('u') || !parseHex4(&low) ||
+              low < 0xDC00 || low >= 0xE000) {
+            return false;
+          }
+          code_point = 0x10000 + ((code_point - 0xD800) << 10) +
+                       (low - 0xDC00);
+        }
+        appendUtf8(code_point, out);
+        break;
+      }
+      default:
+        return false;
+      }
+    }
+    return false;
+  }
+
+  bool parseValue(JsonValue *value) {
+    size_t start = pos_;
+    if (pos_ >= text_.size()) {
+      return false;
+    }
+    char c = text_[pos_];
+    if (c == '"') {
+      value->kind = JsonValue::Kind::kString;
+      if (!parseString(&value->text)) {
+        return false;
+      }
+    } else if (c == '[') {
+      value->kind = JsonValue::Kind::kArray;
+      ++pos_;
+      skipWhitespace();
+      if (!expect(']')) {
+        do {
+          skipWhitespace();
+          std::string item;
+          if (!parseString(&item)) {
+            return false;
+          }
+          value->items.push_back(item);
+          skipWhitespace();
+        } while (expect(','));
+        if (!expect(']')) {
+          return false;
+        }
+      }
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+      value->kind = JsonValue::Kind::kNumber;
+      while (pos_ < text_.size() &&
+             strchr("+-0123456789.eE", text_[pos_]) != nullptr) {
+        ++pos_;
+      }
+      value->text = text_.substr(start, pos_ - start);
+      char *end = nullptr;
+      strtod(value->text.c_str(), &end);
+      if (*end != '\0') {
+        return false;
+      }
+    } else {
+      value->kind = JsonValue::Kind::kLiteral;
+      for (const char *literal : {"true", "false", "null"}) {
+        if (text_.compare(pos_, strlen(literal), literal) == 0) {
+          value->text = literal;
+          pos_ += strlen(literal);
+          break;
+        }
+      }
+      if (value->text.empty()) {
+        return false;
+      }
+    }
+    value->raw = text_.substr(start, pos_ - start);
+    return true;
+  }
+
+  const std::string &text_;
+  size_t pos_ = 0;
+};
+
+// Returns `s` as a JSON string literal.
+std::string jsonQuote(const std::string &s) {
+  std::string result = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (c == '\n') {
+      result += "\\n";
+    } else if ((unsigned char)c < 0x20) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", (unsigned)c);
+      result += escape;
+    } else {
+      result += c;
+    }
+  }
+  result += '"';
+  return result;
+}
+
+// Checks that every extension requested by a target exists and is supported
+// by the target's API. Gives more specific messages than generate(), and
+// avoids its warnings on stderr.
+bool checkExtensions(const Registry &registry,
+                     const GenerationOptions &options,
+                     std::string *error) {
+  const uint64_t api_bit = findApiBit(registry, options.api_name);
+  for (const std::string &extension_name : options.extensions) {
+    auto extension_it =
+        std::find_if(registry.extensions.begin(),
+                     registry.extensions.end(),
+                     [&extension_name](const ExtensionInfo &extension) {
+                       return extension.name == extension_name;
+                     });
+    if (extension_it == registry.extensions.end()) {
+      *error = "Invalid extension specified: " + extension_name;
+      return false;
+    }
+    if ((extension_it->supported_apis & api_bit) == 0) {
+      *error = "Extension " + extension_name + " is not supported by API " +
+               options.api_name;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Where responses to a client's requests go: a socket, or stdout if `fd` is
+// -1. Sockets are closed when the last reference to the connection goes away,
+// i.e. once the client stopped sending and all its requests are answered.
+class ServerConnection {
+public:
+  explicit ServerConnection(int fd) : fd_(fd) {}
+  ServerConnection(const ServerConnection&) = delete;
+  ServerConnection& operator=(const ServerConnection&) = delete;
+
+  ~ServerConnection() {
+#if defined(GALOGEN_HAS_SOCKETS)
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+#endif
+  }
+
+  int fd() const { return fd_; }
+
+  void send(const std::string &line) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0) {
+      fprintf(stdout, "%s\n", line.c_str());
+      fflush(stdout);
+      return;
+    }
+#if defined(GALOGEN_HAS_SOCKETS)
+    std::string data = line + "\n";
+    size_t sent = 0;
+    while (sent < data.size()) {
+      ssize_t result = write(fd_, data.data() + sent, data.size() - sent);
+      if (result <= 0) {
+        // The client went away; nobody is left to tell.
+        return;
+      }
+      sent += (size_t)result;
+    }
+#endif
+  }
+
+private:
+  int fd_;
+  std::mutex mutex_;
+};
+
+// Generates targets for requests, using a pool of worker threads.
+class Server {
+public:
+  Server(const Registry &registry,
+         const GenerationOptions &defaults,
+         bool api_ver_specified,
+         const GeneratorMap &generators,
+         Timings *timings,
+         RunStats *stats) :
+      registry_(registry), defaults_(defaults),
+      api_ver_specified_(api_ver_specified), generators_(generators),
+      timings_(timings), stats_(stats) {}
+
+  Server(const Server&) = delete;
+  Server& operator=(const Server&) = delete;
+
+  // Starts the workers. If `jobs` is 0, starts one per hardware thread.
+  void start(unsigned jobs) {
+    if (jobs == 0) {
+      jobs = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for (unsigned i = 0; i < jobs; ++i) {
+      workers_.emplace_back([this]() { work(); });
+    }
+  }
+
+  // Queues a request. The response is sent to `connection`.
+  void submit(std::string request,
+              std::shared_ptr<ServerConnection> connection) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      requests_.emplace_back(std::move(request), std::move(connection));
+    }
+    request_added_.notify_one();
+  }
+
+  // Handles all queued requests, then stops the workers.
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    request_added_.notify_all();
+    for (std::thread &worker : workers_) {
+      worker.join();
+    }
+    workers_.clear();
+  }
+
+  // Handles a single request line and returns the response line.
+  std::string handle(const std::string &request) {
+    std::vector<std::pair<std::string, JsonValue>> members;
+    std::string error;
+    std::string id = "null";
+    bool ok = JsonObjectParser(request).parse(&members, &error);
+    for (const auto &member : members) {
+      if (member.first == "id") {
+        id = member.second.raw;
+      }
+    }
 
-namespace internal {
+    static const struct { const char *key; const char *option; } kKeys[] = {
+      {"api", "--api"}, {"ver", "--ver"}, {"profile", "--profile"},
+      {"exts", "--exts"}, {"generator", "--generator"},
+      {"filename", "--filename"}, {"usage_dirs", "--usage-dirs"},
+      {"usage_cache", "--usage-cache"}
+    };
+    GenerationOptions target = defaults_;
+    bool api_ver_specified = api_ver_specified_;
+    for (size_t i = 0; ok && i < members.size(); ++i) {
+      const std::string &key = members[i].first;
+      const JsonValue &value = members[i].second;
+      if (key == "id") {
+        continue;
+      }
+      const char *option = nullptr;
+      for (const auto &k : kKeys) {
+        if (key == k.key) {
+          option = k.option;
+        }
+      }
+      std::string option_value = value.text;
+      if ((key == "exts" || key == "usage_dirs") &&
+          value.kind == JsonValue::Kind::kArray) {
+        option_value.clear();
+        for (const std::string &item : value.items) {
+          option_value += (option_value.empty() ? "" : ",") + item;
+        }
+      } else if (option != nullptr &&
+                 value.kind != JsonValue::Kind::kString) {
+        error = "Value of \"" + key + "\" must be a string";
+        ok = false;
+        break;
+      }
+      if (option == nullptr) {
+        error = "Unknown request key \"" + key + "\"";
+        ok = false;
+      } else {
+        ok = applyTargetOption(option,
+                               option_value,
+                               generators_,
+                               &target,
+                               &api_ver_specified,
+                               &error) == OptionResult::kApplied;
+      }
+    }
+    if (ok && !api_ver_specified) {
+      setDefaultApiVersion(&target);
+    }
+    ok = ok && checkExtensions(registry_, target, &error);
+    if (ok) {
+      std::unique_ptr<OutputGenerator> generator =
+          generators_.at(target.generator_name)();
+      // Requests for the same files are handled one after the other, so that
+      // the files hold the output of the request answered last.
+      OutputLock output_lock(this, target.filename);
+      FileSink sink;
+      std::vector<std::string> warnings;
+      ok = generate(registry_,
+                    target,
+                    generator.get(),
+                    &sink,
+                    &error,
+                    &warnings,
+                    timings_,
+                    stats_);
+      printWarnings(warnings);
+    }
+    if (ok) {
+      return "{\"id\": " + id + ", \"ok\": true}";
+    }
+    return "{\"id\": " + id + ", \"ok\": false, \"error\": " +
+           jsonQuote(error) + "}";
+  }
 
-template <class A, class B>
-using XmlIter =
-typename std::conditional<
-    std::is_const<typename std::remove_pointer<A>::type>::value,
-                  const B*, B*>::type;
+private:
+  // Keeps other workers from writing files with the given name (without
+  // extension) while it exists.
+  class OutputLock {
+  public:
+    OutputLock(Server *server, const std::string &filename) :
+        server_(server), filename_(filename) {
+      std::unique_lock<std::mutex> lock(server_->outputs_mutex_);
+      server_->output_released_.wait(lock, [this]() {
+        return server_->busy_outputs_.count(filename_) == 0;
+      });
+      server_->busy_outputs_.insert(filename_);
+    }
 
-#define FOR_EACH_CHILD(n, as) \
-  for (XmlIter<decltype(n), tinyxml2::XMLNode> as = n->FirstChild(); \
-       as != nullptr; as = as->NextSibling())
+    ~OutputLock() {
+      {
+        std::lock_guard<std::mutex> lock(server_->outputs_mutex_);
+        server_->busy_outputs_.erase(filename_);
+      }
+      server_->output_released_.notify_all();
+    }
 
-#define FOR_EACH_CHILD_ELEM_NAMED(name, n, as) \
-  for(XmlIter<decltype(n), tinyxml2::XMLElement> as = \
-          n->FirstChildElement(name); \
-      as != nullptr; as = as->NextSiblingElement(name))
+    OutputLock(const OutputLock&) = delete;
+    OutputLock& operator=(const OutputLock&) = delete;
 
-#define FOR_EACH_CHILD_ELEM(n, as) FOR_EACH_CHILD_ELEM_NAMED(nullptr, n, as)
+  private:
+    Server *server_;
+    std::string filename_;
+  };
 
-// An API entity is a type, enum or command.
-// An entity is defined by data extracted from its corresponding XML element.
-// However, the same entity may be represented by differently in
-// different APIs (e.g. an enum might have different values in GL vs GL ES).
-template <class T>
-class ApiEntity {
-public:
-  void add(const T &e) { set_.push_back(e); }
-  
-  const T* get(const char *api) const {
-    const T *result = nullptr;
-    for (const T &e : set_) {
-      if ((e.api.empty()  && result == nullptr) ||
-          (!e.api.empty() && e.api == api)) {
-        result = &e;
-      } 
+  void work() {
+    for (;;) {
+      std::pair<std::string, std::shared_ptr<ServerConnection>> request;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        request_added_.wait(lock, [this]() {
+          return stopping_ || !requests_.empty();
+        });
+        if (requests_.empty()) {
+          return;
+        }
+        request = std::move(requests_.front());
+        requests_.pop_front();
+      }
+      request.second->send(handle(request.first));
     }
-    return result;
   }
-  
-  // Mark this entity as processed.
-  void markProcessed() { processed_ = true; }
 
-  // Return true if the entity is marked as processed.
-  bool isProcessed() const { return processed_; }
+  const Registry &registry_;
+  const GenerationOptions &defaults_;
+  const bool api_ver_specified_;
+  const GeneratorMap &generators_;
+  Timings *timings_;
+  RunStats *stats_;
 
-private:
-  std::vector<T> set_;
-  bool processed_ = false;
+  std::mutex mutex_;
+  std::condition_variable request_added_;
+  std::deque<std::pair<std::string, std::shared_ptr<ServerConnection>>>
+      requests_;
+  bool stopping_ = false;
+  std::vector<std::thread> workers_;
+
+  // Names of the files being generated (see OutputLock).
+  std::mutex outputs_mutex_;
+  std::condition_variable output_released_;
+  std::unordered_set<std::string> busy_outputs_;
 };
 
-// Maps names to API entities.
-template <class T>
-using EntityMap = std::unordered_map<std::string, ApiEntity<T>>;
-
-void populateEntity(TypeInfo *info, const tinyxml2::XMLElement *e) {
-  if (const char *name_attrib = e->Attribute("name")) {
-    info->name = name_attrib;
-  }
-  if (const char *requires_attrib = e->Attribute("requires")) {
-    info->prerequisite_type = requires_attrib;
-  }
-  if (const char *api_attrib = e->Attribute("api")) {
-    info->api = api_attrib;
-  }
-  FOR_EACH_CHILD(e, child) {
-    if (const tinyxml2::XMLText *text = child->ToText()) {
-      info->type_cdecl += text->Value();
-    } else if (const tinyxml2::XMLElement *elem = child->ToElement()) {
-      const char *tag_name = elem->Value();
-      if (strcmp(tag_name, "name") == 0) {
-        info->name = elem->GetText();
-        info->type_cdecl += " " + info->name;
-      } else if (strcmp(tag_name, "apientry") == 0) {
-        info->type_cdecl += " GL_APIENTRY ";
-      } else {
-        FAIL("Unexpected element \"%s\" in type definition on line %d\n",
-              tag_name,
-              e->GetLineNum());
-      }
-    }
-  }
-  FAIL_IF(info->name.empty(), "Type missing \"name\" attribute on line %d\n",
-          e->GetLineNum());
-}
-
-void populateEntity(EnumerantInfo *info, const tinyxml2::XMLElement *e) {
-  info->name = e->Attribute("name");
-  info->value = e->Attribute("value");
-  FAIL_IF(info->name.empty() || info->value.empty(),
-          "Enumerant missing \"name\" or \"value\" attribute on line %d\n",
-          e->GetLineNum());
-  if (const char *type_attrib = e->Attribute("type")) {
-    info->suffix = type_attrib;
-  }
-  if (const char *alias_attrib = e->Attribute("alias")) {
-    info->alias = alias_attrib;
-  }
-  if (const char *api_attrib = e->Attribute("api")) {
-    info->api = api_attrib;
-  }
-}
-
-void populateEntity(GroupInfo *info,
-                    const tinyxml2::XMLElement *e,
-                    const internal::EntityMap<EnumerantInfo> &map,
-                    const std::string &api_name) {
-  info->name = e->Attribute("name");
-  FAIL_IF(info->name.empty(),
-          "Group missing \"name\" attribute on line %d\n",
-          e->GetLineNum());
-  FOR_EACH_CHILD_ELEM_NAMED("enum", e, enum_ref) {
-    const char *ref_name = enum_ref->Attribute("name");
-    FAIL_IF(ref_name == nullptr,
-            "Enum reference missing name attribute on line %d\n",
-            enum_ref->GetLineNum());
-    auto enum_it = map.find(ref_name);
-    FAIL_IF(enum_it == map.end(),
-            "Reference to undefined enum %s on line %d\n",
-            ref_name,
-            enum_ref->GetLineNum());
-    const EnumerantInfo *enum_info =
-        enum_it->second.get(api_name.c_str());
-    FAIL_IF(enum_info == nullptr,
-            "Failed to find enum %s for api %s\n",
-            ref_name, api_name.c_str());
-    info->enums.push_back(enum_info);
-  }
-}
-
-void populateEntity(CommandInfo::ParamInfo *info,
-                    const tinyxml2::XMLElement *e) {
-  if (const char *group_attr = e->Attribute("group")) {
-    info->group = group_attr;
-  }
-  if (const char *len_attr = e->Attribute("len")) {
-    info->len = len_attr;
-  }
-  FOR_EACH_CHILD(e, child) {
-    if (const tinyxml2::XMLText *text = child->ToText()) {
-      info->ctype += text->Value();
-    } else if (const tinyxml2::XMLElement *elem = child->ToElement()) {
-      const char *tag_name = elem->Value();
-      if (strcmp(tag_name, "ptype") == 0) {
-        info->referenced_api_type = elem->GetText();
-        info->ctype += info->referenced_api_type;
-      } else if (strcmp(tag_name, "name") == 0) {
-        info->name = elem->GetText();
-        
-      } else {
-        FAIL("Unknown tag \"%s\" on line %d\n",
-             tag_name,
-             elem->GetLineNum());
-      }
-    }
-  }
-}
-
-void populateEntity(CommandInfo *info,
-                    const tinyxml2::XMLElement *e) {
-  const tinyxml2::XMLElement *prototype_elem = e->FirstChildElement("proto");
-  FOR_EACH_CHILD(prototype_elem, child) {
-    if (const tinyxml2::XMLText *text = child->ToText()) {
-      info->return_ctype += std::string(" ") + text->Value();
-      info->prototype += text->Value();
-    } else if (const tinyxml2::XMLElement *elem = child->ToElement()) {
-      const char *tag_name = elem->Value();
-      if (strcmp(tag_name, "ptype") == 0) {
-        info->return_ctype += std::string(" ") + elem->GetText();
-        info->referenced_api_type = elem->GetText();
-        info->prototype += elem->GetText();
-      } else if (strcmp(tag_name, "name") == 0) {
-        info->name = elem->GetText();
-        info->prototype += info->name;
-      } else {
-        FAIL("Unknown tag \"%s\" on line %d\n",
-             tag_name,
-             elem->GetLineNum());
+// Returns true if `line` contains something other than whitespace.
+bool isRequestLine(const std::string &line) {
+  return line.find_first_not_of(" \t\r\n") != std::string::npos;
+}
+
+#if defined(GALOGEN_HAS_SOCKETS)
+// Fills in a UNIX socket address for the path in a "unix:<path>" address.
+void makeSocketAddress(const std::string &address, sockaddr_un *socket_address) {
+  std::string path = address.substr(5);
+  FAIL_IF(path.empty() || path.size() >= sizeof(socket_address->sun_path),
+          "Invalid socket path \"%s\"\n",
+          path.c_str());
+  memset(socket_address, 0, sizeof(*socket_address));
+  socket_address->sun_family = AF_UNIX;
+  memcpy(socket_address->sun_path, path.c_str(), path.size() + 1);
+}
+
+// Reads request lines from a client and queues them. Runs on a thread of its
+// own for each client.
+void readRequests(Server *server, std::shared_ptr<ServerConnection> connection) {
+  std::string pending;
+  char buffer[4096];
+  for (;;) {
+    ssize_t bytes_read = read(connection->fd(), buffer, sizeof(buffer));
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      break;
+    }
+    pending.append(buffer, (size_t)bytes_read);
+    size_t line_end;
+    while ((line_end = pending.find('\n')) != std::string::npos) {
+      std::string line = pending.substr(0, line_end);
+      pending.erase(0, line_end + 1);
+      if (isRequestLine(line)) {
+        server->submit(std::move(line), connection);
       }
     }
-
-    // Clean up return ctype.
-    std::string &return_ctype = info->return_ctype;
-    auto l = [](int c) { return !isspace(c); };
-    return_ctype.erase(return_ctype.begin(), std::find_if(return_ctype.begin(),
-                                                          return_ctype.end(),
-                                                          l ));
-    return_ctype.erase(std::find_if(return_ctype.rbegin(),
-                                    return_ctype.rend(),
-                                    l).base(), return_ctype.end());
-  }
-  FOR_EACH_CHILD_ELEM_NAMED("param", e, param) {
-    CommandInfo::ParamInfo param_info;
-    populateEntity(&param_info, param);
-    info->parameters.emplace_back(std::move(param_info));
-  }
-  if (const tinyxml2::XMLElement *alias_elem =
-          e->FirstChildElement("alias")) {
-    info->alias = alias_elem->Attribute("name");
   }
-  if (const tinyxml2::XMLElement *vecequiv_elem =
-          e->FirstChildElement("vecequiv")) {
-    info->vecequiv = vecequiv_elem->Attribute("name");
+  if (isRequestLine(pending)) {
+    server->submit(std::move(pending), connection);
   }
 }
+#endif
 
-template <class T, class... Types>
-void loadEntities(const tinyxml2::XMLElement *container,
-                  const char *kind,
-                  EntityMap<T> &map,
-                  Types&... extra_args) {
-  FOR_EACH_CHILD_ELEM_NAMED(kind, container, entity_element) {
-    T entity_info;
-    populateEntity(&entity_info, entity_element, extra_args...);
-    map[entity_info.name].add(entity_info);
+// Runs the server until stdin is exhausted, or forever for sockets.
+void serve(const Registry &registry,
+           const GenerationOptions &options,
+           bool api_ver_specified,
+           const GeneratorMap &generators,
+           Timings *timings,
+           RunStats *stats) {
+  Server server(registry,
+                options,
+                api_ver_specified,
+                generators,
+                timings,
+                stats);
+  server.start(options.jobs);
+  if (options.serve_address == "stdio") {
+    std::shared_ptr<ServerConnection> output(new ServerConnection(-1));
+    std::string line;
+    while (std::getline(std::cin, line)) {
+      if (isRequestLine(line)) {
+        server.submit(line, output);
+      }
+    }
+    server.stop();
+    return;
   }
-}
-
-// Convenience class for comparing API versions.
-class ApiVersion {
-public:
-  ApiVersion() = default;
-  explicit ApiVersion(const char *version_string) {
-    static std::regex expr("^([0-9]+)\\.([0-9]+)$",
-                           std::regex_constants::ECMAScript);
-    std::cmatch match; 
-    std::regex_match(version_string, match, expr);
-    if (match.size() == 3) {
-      ver_maj_ = atoi(match[1].str().c_str());
-      ver_min_ = atoi(match[2].str().c_str());
-      valid_ = true;
+#if defined(GALOGEN_HAS_SOCKETS)
+  // A client that disconnects early must not take the server down.
+  signal(SIGPIPE, SIG_IGN);
+  sockaddr_un socket_address;
+  makeSocketAddress(options.serve_address, &socket_address);
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  FAIL_IF(listen_fd < 0, "Failed to create socket\n");
+  // Replace the socket of a server that is no longer running.
+  unlink(socket_address.sun_path);
+  FAIL_IF(bind(listen_fd,
+               (const sockaddr*)&socket_address,
+               sizeof(socket_address)) != 0 ||
+          listen(listen_fd, SOMAXCONN) != 0,
+          "Failed to listen on %s\n",
+          socket_address.sun_path);
+  fprintf(stderr, "Listening on %s\n", socket_address.sun_path);
+  for (;;) {
+    int client_fd = accept(listen_fd, nullptr, nullptr);
+    if (client_fd < 0) {
+      FAIL_IF(errno != EINTR && errno != ECONNABORTED,
+              "Failed to accept connection\n");
+      continue;
     }
+    std::shared_ptr<ServerConnection> connection(
+        new ServerConnection(client_fd));
+    std::thread(readRequests, &server, connection).detach();
   }
+#else
+  FAIL("UNIX sockets are not supported on this platform\n");
+#endif
+}
 
-  bool operator<=(const ApiVersion &other) const {
-    if (ver_maj_ < other.ver_maj_) {
-      return true;
-    } else if (ver_maj_ == other.ver_maj_) {
-      return ver_min_ <= other.ver_min_;
+// Client for testing a server: sends the requests read from stdin to the
+// server listening at `address` and prints its responses. Returns the exit
+// code for the process, which is 1 if any request failed.
+int runClient(const std::string &address) {
+#if defined(GALOGEN_HAS_SOCKETS)
+  FAIL_IF(address.compare(0, 5, "unix:") != 0,
+          "Server address must be \"unix:<socket path>\"\n");
+  sockaddr_un socket_address;
+  makeSocketAddress(address, &socket_address);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  FAIL_IF(fd < 0 ||
+          connect(fd,
+                  (const sockaddr*)&socket_address,
+                  sizeof(socket_address)) != 0,
+          "Failed to connect to %s\n",
+          socket_address.sun_path);
+  ServerConnection connection(fd);
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    if (isRequestLine(line)) {
+      connection.send(line);
     }
-    return false;
   }
-  
-  bool operator>(const ApiVersion &other) const {
-    return !(*this <= other);
+  shutdown(fd, SHUT_WR);
+  int exit_code = 0;
+  std::string pending;
+  char buffer[4096];
+  ssize_t bytes_read;
+  while ((bytes_read = read(fd, buffer, sizeof(buffer))) != 0) {
+    if (bytes_read < 0) {
+      FAIL_IF(errno != EINTR, "Failed to read from %s\n",
+              socket_address.sun_path);
+      continue;
+    }
+    pending.append(buffer, (size_t)bytes_read);
+    size_t line_end;
+    while ((line_end = pending.find('\n')) != std::string::npos) {
+      std::string response = pending.substr(0, line_end);
+      pending.erase(0, line_end + 1);
+      printf("%s\n", response.c_str());
+      if (response.find("\"ok\": true") == std::string::npos) {
+        exit_code = 1;
+      }
+    }
   }
+  return exit_code;
+#else
+  FAIL("UNIX sockets are not supported on this platform\n");
+#endif
+}
 
-  bool valid() const { return valid_; }
+#endif
 
-  int maj() const { return ver_maj_; }
-  int min() const { return ver_min_; }
+}
+}
 
-private:
-  int ver_maj_ = 0;
-  int ver_min_ = 0;
-  bool valid_ = false;
-};
+// ----------------------------------------------------------------------------
+// Library interface (see galogen.h).
 
-extern const char *source_preamble;
-extern const char *header_preamble;
+namespace galogen {
 
-struct GenerationOptions {
-  std::string registry_file_name;
-  std::string api_name;
-  ApiVersion api_version;
-  std::string profile;
-  OutputGenerator *generator;
-  std::string filename;
-  std::unordered_set<std::string> extensions;
-};
+bool FileSink::write(const std::string &file_name,
+                     const std::string &contents,
+                     std::string *error) {
+  if (!internal::writeFileIfChanged(file_name, contents)) {
+    *error = "Failed to create output file " + file_name;
+    return false;
+  }
+  return true;
+}
 
-void processOperations(
-    const tinyxml2::XMLElement *op_list,
-    const GenerationOptions &options,
-    const EntityMap<CommandInfo> &command_map,
-    std::unordered_map<std::string,
-                       std::unordered_set<std::string>> &entity_sets) {
-  FOR_EACH_CHILD_ELEM(op_list, operation) {
-    const char *profile_attrib = operation->Attribute("profile");
-    if (profile_attrib &&
-        strcmp(profile_attrib, options.profile.c_str()) != 0) {
+Registry::Registry() = default;
+Registry::~Registry() = default;
+Registry::Registry(Registry&&) = default;
+Registry& Registry::operator=(Registry&&) = default;
+
+bool Registry::load(const std::string &file_name, std::string *error) {
+  registry_.reset();
+  std::unique_ptr<internal::Registry> registry(new internal::Registry());
+  internal::RegistryLoadOptions options;
+  options.file_name = file_name;
+  if (!internal::loadRegistry(options, registry.get(), error)) {
+    return false;
+  }
+  registry_ = std::move(registry);
+  return true;
+}
+
+bool generate(const Registry &registry,
+              const Target &target,
+              OutputSink *sink,
+              std::string *error,
+              std::vector<std::string> *warnings) {
+  if (!registry.loaded()) {
+    *error = "Registry is not loaded";
+    return false;
+  }
+  static const internal::GeneratorMap generators = []() {
+    internal::GeneratorMap g;
+    internal::createGenerators(g);
+    return g;
+  }();
+
+  // Targets are validated the same way as command line options.
+  std::string extensions;
+  for (const std::string &extension : target.extensions) {
+    if (!extensions.empty()) {
+      extensions += ',';
+    }
+    extensions += extension.compare(0, 3, "GL_") == 0 ? extension.substr(3)
+                                                      : extension;
+  }
+  std::string usage_dirs;
+  for (const std::string &directory : target.usage_dirs) {
+    usage_dirs += (usage_dirs.empty() ? "" : ",") + directory;
+  }
+  const std::pair<const char*, std::string> args[] = {
+    {"--api", target.api},
+    {"--profile", target.profile},
+    {"--generator", target.generator},
+    {"--filename", target.filename},
+    {"--exts", extensions},
+    {"--usage-dirs", usage_dirs},
+    {"--usage-cache", target.usage_cache},
+    {"--ver", target.version}
+  };
+  internal::GenerationOptions options;
+  bool api_ver_specified = false;
+  for (const auto &arg : args) {
+    if (arg.second.empty() && strcmp(arg.first, "--ver") == 0) {
       continue;
     }
-
-    bool require = strcmp(operation->Value(), "require") == 0;
-    FOR_EACH_CHILD_ELEM(operation, entity_ref) {
-      const char *entity_type = entity_ref->Value();
-      std::string name_attrib = entity_ref->Attribute("name");
-      FAIL_IF(name_attrib.empty(),
-              "%s missing name attribute on line %d\n",
-              entity_type,
-              entity_ref->GetLineNum());
-      if (require) {
-        entity_sets[entity_type].insert(name_attrib);
-        if (strcmp(entity_type, "command") == 0) {
-          // Types are (usually) not directly specified in the feature
-          // element. They are supposed to be picked up transitively via 
-          // command signatures. Same applies to groups.
-          const CommandInfo *command =
-            command_map.at(name_attrib).get(options.api_name.c_str());
-          if (!command->referenced_api_type.empty()) {
-            entity_sets["type"].insert(command->referenced_api_type);
-          }
-          for (const CommandInfo::ParamInfo &param : command->parameters) {
-            if (!param.referenced_api_type.empty()) {
-              entity_sets["type"].insert(param.referenced_api_type);
-            }
-            if(!param.group.empty()) {
-              entity_sets["group"].insert(param.group);
-            }
-          }
-        }
-      } else {
-        entity_sets[entity_type].erase(name_attrib);
-      }
+    if (internal::applyTargetOption(arg.first,
+                                    arg.second,
+                                    generators,
+                                    &options,
+                                    &api_ver_specified,
+                                    error) != internal::OptionResult::kApplied) {
+      return false;
     }
   }
+  if (!api_ver_specified) {
+    internal::setDefaultApiVersion(&options);
+  }
+  std::unique_ptr<OutputGenerator> generator =
+      generators.at(options.generator_name)();
+  return internal::generate(*registry.registry_,
+                            options,
+                            generator.get(),
+                            sink,
+                            error,
+                            warnings);
 }
 
-void generate(GenerationOptions &options) {
-  // Load the registry file.
-  tinyxml2::XMLDocument spec;
-  FAIL_IF(spec.LoadFile(options.registry_file_name.c_str()) !=
-             tinyxml2::XML_SUCCESS,
-          "Failed to load file %s",
-          options.registry_file_name.c_str());
-  tinyxml2::XMLElement *root = spec.RootElement();
-  
-  EntityMap<TypeInfo> type_map;
-  EntityMap<EnumerantInfo> enum_map;
-  EntityMap<CommandInfo> command_map;
-  EntityMap<GroupInfo> group_map;
-  
-  // Load information about API entities into the maps.
-  loadEntities(root->FirstChildElement("types"), "type", type_map);
-  loadEntities(root->FirstChildElement("commands"), "command", command_map);
-  FOR_EACH_CHILD_ELEM_NAMED("enums", root, enums_container) {
-    loadEntities(enums_container, "enum", enum_map);
-  }
-  loadEntities(root->FirstChildElement("groups"),
-               "group",
-               group_map,
-               enum_map,
-               options.api_name);
+}
 
-  // Each API version is described in a "feature" element.
-  // The contents of the tag specify the difference against the previous version
-  // (i.e. which types/commands/enums were added or removed).
-  // Therefore, to get the full description of an API version, we need to
-  // process all feature elements up to and including the required version, in
-  // order of increasing version.
-  // Its is not guaranteed that the "feature" elements will appear in any
-  //  particular order, so we sort them first.
-  std::vector<const tinyxml2::XMLElement*> feature_elements;
-  std::vector<ApiVersion> api_version_numbers;
-  FOR_EACH_CHILD_ELEM_NAMED("feature", root, feature) {
-    const char *feature_api = feature->Attribute("api");
-    FAIL_IF(feature_api == nullptr,
-            "Feature tag missing api attribute on line %d\n",
-            feature->GetLineNum());
-    if (strcmp(feature_api, options.api_name.c_str()) == 0) {
-      feature->SetUserData((void*)api_version_numbers.size());
-      api_version_numbers.push_back(ApiVersion(feature->Attribute("number")));
-      feature_elements.push_back(feature);
-    }
-  }
-  std::sort(feature_elements.begin(),
-            feature_elements.end(),
-            [&api_version_numbers](const tinyxml2::XMLElement *e1,
-               const tinyxml2::XMLElement *e2) {
-              return api_version_numbers[(size_t)e1->GetUserData()] <=
-                     api_version_numbers[(size_t)e2->GetUserData()];
-            });
-
-  // Process API versions.
-  std::unordered_map<std::string,
-                     std::unordered_set<std::string>> entity_sets;
-  for (const tinyxml2::XMLElement *feature_element : feature_elements) {
-    const ApiVersion &v =
-        api_version_numbers[(size_t)feature_element->GetUserData()];
-    if (v > options.api_version) { break; }
-    processOperations(feature_element, options, command_map, entity_sets);
-  }
+// Everything below, up to the output generators, is only needed by the
+// command line tool. Programs that use Galogen as a library define
+// GALOGEN_LIBRARY, so they get neither main() nor Galogen's replacement of the
+// global allocation functions.
+#if !defined(GALOGEN_LIBRARY)
 
-  // Process extensions.
-  const tinyxml2::XMLElement *extension_list =
-      root->FirstChildElement("extensions");
-  FOR_EACH_CHILD_ELEM_NAMED("extension", extension_list, extension) {
-    std::string extension_name = extension->Attribute("name");
-    FAIL_IF(extension_name.empty(),
-            "Extension missing \"name\" attribute on line %d\n",
-            extension->GetLineNum());
-    std::string supported_api = extension->Attribute("supported");
-    FAIL_IF(supported_api.empty(),
-            "Extension missing \"supported\" attribute on line %d\n",
-            extension->GetLineNum());
-    std::regex supported_api_regex("^" + supported_api + "$",
-                                   std::regex_constants::ECMAScript);
-    bool extension_supported =
-        std::regex_match(options.api_name, supported_api_regex);
-    bool extension_requested = options.extensions.count(extension_name) >= 1;
-    if (extension_requested && extension_supported) {
-      processOperations(extension, options, command_map, entity_sets);
-      options.extensions.erase(extension_name);
-    } else if (extension_requested) {
-      fprintf(stderr,
-              "WARNING: extension %s requested, but not supported by API %s\n",
-              extension_name.c_str(), options.api_name.c_str());
-    }
-  }
-  std::ostringstream remaining_extensions;
-  std::copy(options.extensions.begin(), options.extensions.end(),
-            std::ostream_iterator<std::string>(remaining_extensions, ", "));
-  FAIL_IF(!remaining_extensions.str().empty(),
-          "Invalid extensions specified: %s\n",
-          remaining_extensions.str().c_str());
-  options.generator->start(options.filename, options.api_name, options.profile,
-                           options.api_version.maj(),
-                           options.api_version.min());
-  std::function<void(ApiEntity<TypeInfo>&)> output_type =
-      [&](ApiEntity<TypeInfo> &type) {
-        const TypeInfo *info = type.get(options.api_name.c_str());
-        FAIL_IF(info == nullptr,
-                "Couldn't find type for api %s\n",
-                options.api_name.c_str());
-        if (type.isProcessed()) {
-          return;
-        }
-        if (!info->prerequisite_type.empty()) {
-          output_type(type_map[info->prerequisite_type]);
-        }
-        options.generator->processType(*info);
-        type.markProcessed();
-      };
+// Count heap allocations for --stats.
+//
+// GCC warns about free() being called on memory from operator new when it
+// inlines operator delete, not knowing that both are replaced, so
+// operator delete is kept out of line there.
+#if defined(__GNUC__)
+#define GALOGEN_NOINLINE __attribute__((noinline))
+#else
+#define GALOGEN_NOINLINE
+#endif
 
-  // KLUDGE: GLDEBUGPROC depends on these types but doesn't declare them as
-  //         dependencies in any visible way. So force-output them at the very
-  //         beginning.
-  //         See https://github.com/KhronosGroup/OpenGL-Registry/issues/160
-  output_type(type_map["GLenum"]);
-  output_type(type_map["GLuint"]);
-  output_type(type_map["GLsizei"]);
-  output_type(type_map["GLchar"]);
- 
-  const std::unordered_set<std::string> &types = entity_sets["type"];
-  for (const auto &type_name : types) {
-    auto type_it = type_map.find(type_name);
-    FAIL_IF(type_it == type_map.end(),
-            "Reference to undefined type %s\n",
-            type_name.c_str());
-    output_type(type_it->second);
+// Like malloc(), or an aligned allocation if `alignment` is not 0, but
+// follows the rules for operator new when memory runs out: calls the new
+// handler until it gives up, then throws std::bad_alloc (or aborts, where
+// exceptions are disabled).
+static void* countedAllocate(size_t size, size_t alignment) {
+  ++galogen::internal::allocation_count;
+  galogen::internal::allocated_bytes += size;
+  if (size == 0) {
+    size = 1;
   }
-
-  const std::unordered_set<std::string> &groups = entity_sets["group"];
-  for (const auto &group_name : groups) {
-    auto group_it = group_map.find(group_name);
-    if(group_it == group_map.end()) {
-      // It is not an error to refer to a group that had not been defined
-      // before (see readme section 7.3).
-      continue;
+  for (;;) {
+    void *p = nullptr;
+    if (alignment == 0) {
+      p = malloc(size);
+    } else {
+#if defined(_WIN32)
+      p = _aligned_malloc(size, alignment);
+#else
+      if (posix_memalign(&p, alignment, size) != 0) {
+        p = nullptr;
+      }
+#endif
+    }
+    if (p != nullptr) {
+      return p;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr) {
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+      throw std::bad_alloc();
+#else
+      abort();
+#endif
     }
-    const GroupInfo *info = group_it->second.get(options.api_name.c_str());
-    FAIL_IF(info == nullptr,
-            "Failed to find group %s for api %s\n",
-            group_name.c_str(),
-            options.api_name.c_str());
-    options.generator->processEnumGroup(*info);
+    handler();
   }
+}
 
-  const std::unordered_set<std::string> &enums = entity_sets["enum"];
-  for (const auto &enum_name : enums) {
-    auto enum_it = enum_map.find(enum_name);
-    FAIL_IF(enum_it == enum_map.end(),
-            "Reference to undefined enumerant %s\n",
-            enum_name.c_str());
-    const EnumerantInfo *info = enum_it->second.get(options.api_name.c_str());
-    FAIL_IF(info == nullptr,
-            "Failed to find enumerant %s for api %s\n",
-            enum_name.c_str(),
-            options.api_name.c_str());
-    options.generator->processEnumerant(*info);
+// Returns the result of an allocation that throws std::bad_alloc on failure,
+// or nullptr if it throws, for the nothrow forms of operator new.
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#define GALOGEN_TRY_ALLOCATE(allocation) \
+  try { \
+    return (allocation); \
+  } catch (const std::bad_alloc&) { \
+    return nullptr; \
   }
- 
-  const std::unordered_set<std::string> &commands = entity_sets["command"];
-  for (const auto &command_name : commands) {
-    auto command_it = command_map.find(command_name);
-    FAIL_IF(command_it == command_map.end(),
-            "Reference to undefined command %s\n",
-            command_name.c_str());
-    const CommandInfo *info = command_it->second.get(options.api_name.c_str());
-    FAIL_IF(info == nullptr,
-            "Failed to find command %s for api %s\n",
-            command_name.c_str(),
-            options.api_name.c_str());
-    options.generator->processCommand(*info);
-  }
-  options.generator->end();
-  printf("Generation finished successfully!\n");
+#else
+#define GALOGEN_TRY_ALLOCATE(allocation) return (allocation)
+#endif
+
+void* operator new(size_t size) {
+  return countedAllocate(size, 0);
 }
 
-extern const char *help_message;
+void* operator new[](size_t size) {
+  return countedAllocate(size, 0);
+}
 
-using GeneratorMap =
-    std::unordered_map<std::string, std::unique_ptr<OutputGenerator>>;
+GALOGEN_NOINLINE void operator delete(void *p) noexcept {
+  free(p);
+}
 
-void createGenerators(GeneratorMap &g);
+GALOGEN_NOINLINE void operator delete[](void *p) noexcept {
+  free(p);
+}
+
+GALOGEN_NOINLINE void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+GALOGEN_NOINLINE void operator delete[](void *p, size_t) noexcept {
+  free(p);
+}
+
+// The nothrow forms are replaced as well, since the runtime's versions may not
+// allocate through the replaced operator new (e.g. with AddressSanitizer), and
+// their memory is released with free() above.
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  GALOGEN_TRY_ALLOCATE(countedAllocate(size, 0));
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  GALOGEN_TRY_ALLOCATE(countedAllocate(size, 0));
+}
+
+GALOGEN_NOINLINE void operator delete(void *p,
+                                      const std::nothrow_t&) noexcept {
+  free(p);
+}
+
+GALOGEN_NOINLINE void operator delete[](void *p,
+                                        const std::nothrow_t&) noexcept {
+  free(p);
+}
+
+#if defined(__cpp_aligned_new)
+// Memory from _aligned_malloc() must be released with _aligned_free().
+#if defined(_WIN32)
+#define GALOGEN_FREE_ALIGNED _aligned_free
+#else
+#define GALOGEN_FREE_ALIGNED free
+#endif
+
+void* operator new(size_t size, std::align_val_t alignment) {
+  return countedAllocate(size, (size_t)alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+  return countedAllocate(size, (size_t)alignment);
+}
+
+GALOGEN_NOINLINE void operator delete(void *p, std::align_val_t) noexcept {
+  GALOGEN_FREE_ALIGNED(p);
+}
 
+GALOGEN_NOINLINE void operator delete[](void *p, std::align_val_t) noexcept {
+  GALOGEN_FREE_ALIGNED(p);
 }
+
+GALOGEN_NOINLINE void operator delete(void *p,
+                                      size_t,
+                                      std::align_val_t) noexcept {
+  GALOGEN_FREE_ALIGNED(p);
+}
+
+GALOGEN_NOINLINE void operator delete[](void *p,
+                                        size_t,
+                                        std::align_val_t) noexcept {
+  GALOGEN_FREE_ALIGNED(p);
+}
+
+void* operator new(size_t size,
+                   std::align_val_t alignment,
+                   const std::nothrow_t&) noexcept {
+  GALOGEN_TRY_ALLOCATE(countedAllocate(size, (size_t)alignment));
+}
+
+void* operator new[](size_t size,
+                     std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept {
+  GALOGEN_TRY_ALLOCATE(countedAllocate(size, (size_t)alignment));
+}
+
+GALOGEN_NOINLINE void operator delete(void *p,
+                                      std::align_val_t,
+                                      const std::nothrow_t&) noexcept {
+  GALOGEN_FREE_ALIGNED(p);
+}
+
+GALOGEN_NOINLINE void operator delete[](void *p,
+                                        std::align_val_t,
+                                        const std::nothrow_t&) noexcept {
+  GALOGEN_FREE_ALIGNED(p);
 }
+#endif
 
 #if !defined(__EMSCRIPTEN__)
 #define GALOGEN_MAIN int main(int argc, char **argv)
@@ -699,15 +6113,20 @@ GALOGEN_MAIN {
   options.api_name = "gl";
   options.api_version = galogen::internal::ApiVersion("4.0");
   options.profile = "compatibility";
-  options.generator = nullptr;
+  options.generator_name = "c_noload";
   options.filename = "gl";
 
   if (argc <= 1) {
     printf("%s\n", galogen::internal::help_message);
+#if !defined(__EMSCRIPTEN__)
+  } else if (strcmp(argv[1], "--client") == 0) {
+    FAIL_IF(argc != 3, "Usage: galogen --client unix:<socket path>\n");
+    return galogen::internal::runClient(argv[2]);
+#endif
   } else {
-    options.registry_file_name = argv[1];
-    if (options.registry_file_name[0] == '-' &&
-        options.registry_file_name[1] == '-') {
+    options.registry.file_name = argv[1];
+    if (options.registry.file_name[0] == '-' &&
+        options.registry.file_name[1] == '-') {
       fprintf(stderr, "WARNING: First argument \"%s\" looks suspicious."
                       " Did you forget to specify a path to the XML registry"
                       " file?\n",
@@ -715,59 +6134,69 @@ GALOGEN_MAIN {
     }
 
     bool api_ver_specified = false;
-    for (size_t i = 2; i < argc; ++i) {
-      std::string arg = argv[i];
-      if (i + 1 >= argc) {
-        FAIL("Inavlid options\n");
-      }
-      std::string value = argv[++i];
-      if (arg == "--api") {
-        FAIL_IF(value != "gl" && value != "gles2" &&
-                value != "gles1" && value != "glsc2",
-                "Invalid API name %s\n", value.c_str());
-        options.api_name = value;
-      } else if (arg == "--ver") {
-          api_ver_specified = true;
-          options.api_version = galogen::internal::ApiVersion(value.c_str());
-          FAIL_IF(!options.api_version.valid(),
-                  "Invalid version \"%s\"\n",
-                  value.c_str());
-      } else if (arg == "--profile") {
-        FAIL_IF(value != "core" && value != "compatibility",
-                "Profile must be either \"core\" or \"compatibility\"\n");
-        options.profile = value;
-      } else if (arg == "--filename") {
-        options.filename = value;
-      } else if (arg == "--generator") {
-        auto generator_it = generators.find(value);
-        FAIL_IF(generator_it == generators.end(),
-                "Invalid generator \"%s\" specified.\n", value.c_str());
-        options.generator = generator_it->second.get();
-      } else if (arg == "--exts") {
-        std::istringstream stream(value);
-        std::string extension_name;
-        while (std::getline(stream, extension_name, ',')) {
-          options.extensions.insert("GL_" + extension_name);
-        }
-      } else {
-        FAIL("Unrecognized option: %s\n", arg.c_str());
+    galogen::internal::parseOptions(
+        std::vector<std::string>(argv + 2, argv + argc),
+        generators,
+        false,
+        &options,
+        &api_ver_specified);
+    std::vector<galogen::internal::GenerationOptions> targets;
+    if (!options.batch_file_name.empty()) {
+      galogen::internal::readManifest(options,
+                                      api_ver_specified,
+                                      generators,
+                                      &targets);
+    } else {
+      if (!api_ver_specified) {
+        galogen::internal::setDefaultApiVersion(&options);
       }
+      targets.push_back(options);
     }
-    const std::unordered_map<std::string, std::string> default_api_versions {
-      {"gl", "4.0"},
-      {"gles1", "1.0"},
-      {"gles2", "2.0"},
-      {"glsc2", "2.0"}
-    };
-    if (!api_ver_specified) {
-      options.api_version =
-        galogen::internal::ApiVersion(
-          default_api_versions.find(options.api_name)->second.c_str());
+    galogen::internal::Timings timings;
+    galogen::internal::Timings *run_timings =
+        options.timings != galogen::internal::ReportFormat::kNone ?
+            &timings : nullptr;
+    galogen::internal::RunStats stats;
+    galogen::internal::RunStats *run_stats =
+        options.stats != galogen::internal::ReportFormat::kNone ?
+            &stats : nullptr;
+    galogen::internal::ScopedTimer total_timer(run_timings, "total");
+    bool ok = true;
+    std::string error;
+    const galogen::internal::Registry *registry =
+        galogen::internal::registryCache().load(options.registry,
+                                                &error,
+                                                run_timings);
+    FAIL_IF(registry == nullptr, "%s\n", error.c_str());
+    if (!options.serve_address.empty()) {
+#if !defined(__EMSCRIPTEN__)
+      galogen::internal::serve(*registry,
+                               options,
+                               api_ver_specified,
+                               generators,
+                               run_timings,
+                               run_stats);
+#else
+      FAIL("Server mode is not supported in this build\n");
+#endif
+    } else {
+      ok = galogen::internal::generateBatch(*registry,
+                                            targets,
+                                            generators,
+                                            options.jobs,
+                                            run_timings,
+                                            run_stats);
+    }
+    total_timer.stop();
+    if (run_timings != nullptr) {
+      timings.print(stderr, options.timings);
+    }
+    if (run_stats != nullptr) {
+      galogen::internal::printStats(stderr, options.stats, *registry, stats);
     }
-    if (options.generator == nullptr) {
-      options.generator = generators["c_noload"].get();
+    if (!ok) {
+      return 1;
     }
-    generate(options);
   }
   return 0;
 }
@@ -775,6 +6204,8 @@ GALOGEN_MAIN {
 }
 #endif
 
+#endif
+
 namespace galogen {
 namespace internal {
 class COutputGenerator : public OutputGenerator {
@@ -789,117 +6220,111 @@ public:
              const std::string &api_profile,
              int api_ver_maj,
              int api_ver_min) override {
-    output_h_ = fopen((name + ".h").c_str(), "w");
-    output_c_ = fopen((name + ".c").c_str(), "w");
-    FAIL_IF(output_h_ == nullptr || output_c_ == nullptr,
-            "Failed to create output files\n");
-    fprintf(output_h_, "%s\n", header_preamble);
-    fprintf(output_h_,
-            "#define GALOGEN_API_NAME \"%s\"\n"
-            "#define GALOGEN_API_PROFILE \"%s\"\n"
-            "#define GALOGEN_API_VER_MAJ %d\n"
-            "#define GALOGEN_API_VER_MIN %d\n",
-            api_name.c_str(), api_profile.c_str(),
-            api_ver_maj, api_ver_min);
-    fprintf(output_c_, "#include \"%s.h\"\n", name.c_str());
+    name_ = name;
+    // Output is generated into memory and written out in end(). The initial
+    // sizes fit a full desktop GL target with some extensions, so the
+    // buffers rarely need to grow.
+    output_h_.clear();
+    output_c_.clear();
+    output_h_.reserve(kInitialHeaderSize);
+    output_c_.reserve(kInitialSourceSize);
+    output_h_ << header_preamble << '\n';
+    output_h_ << "#define GALOGEN_API_NAME \"" << api_name << "\"\n"
+              << "#define GALOGEN_API_PROFILE \"" << api_profile << "\"\n"
+              << "#define GALOGEN_API_VER_MAJ " << api_ver_maj << '\n'
+              << "#define GALOGEN_API_VER_MIN " << api_ver_min << '\n';
+    output_c_ << "#include \"" << name << ".h\"\n";
     if(!null_driver_) {
-      fprintf(output_c_, "%s\n", source_preamble);
+      output_c_ << source_preamble << '\n';
     }
   }
 
   void processType(const TypeInfo &type) override {
-    fprintf(output_h_, "%s\n", type.type_cdecl.c_str());
+    output_h_ << type.type_cdecl << '\n';
   }
 
   void processEnumerant(const EnumerantInfo &enumerant) override {
-    fprintf(output_h_, "#define %s %s%s\n",
-            enumerant.name.c_str(),
-            enumerant.value.c_str(),
-            enumerant.suffix.c_str());
+    output_h_ << "#define " << enumerant.name << ' '
+              << enumerant.value << enumerant.suffix << '\n';
     if (!enumerant.alias.empty()) {
-      fprintf(output_h_, "#define %s %s%s\n",
-             enumerant.alias.c_str(),
-             enumerant.value.c_str(),
-             enumerant.suffix.c_str());
+      output_h_ << "#define " << enumerant.alias << ' '
+                << enumerant.value << enumerant.suffix << '\n';
     }
   }
 
   void processCommand(const CommandInfo &command) override {
-    // Build parameter list strings.
-    std::string parameter_list_sig, parameter_list_call;
+    // Build parameter list strings. The scratch buffers are reused between
+    // commands.
+    parameter_list_sig_.clear();
+    parameter_list_call_.clear();
+    bool first_param = true;
     for (const CommandInfo::ParamInfo &param : command.parameters) {
-      if (!parameter_list_call.empty() && !parameter_list_sig.empty()) {
-        parameter_list_sig += ", ";
-        parameter_list_call += ", ";
+      if (!first_param) {
+        parameter_list_sig_ << ", ";
+        parameter_list_call_ << ", ";
       }
-      parameter_list_sig += param.ctype + " " + param.name;
-      parameter_list_call += param.name;
+      first_param = false;
+      parameter_list_sig_ << param.ctype << ' ' << param.name;
+      parameter_list_call_ << param.name;
     }
 
     // Output function pointer declaration to header.
-    fprintf(output_h_, // Function pointer type.
-            "\ntypedef %s (GL_APIENTRY *PFN_%s)(%s);\n",
-            command.return_ctype.c_str(),
-            command.name.c_str(),
-            parameter_list_sig.c_str());
-    fprintf(output_h_, // Declaration.
-            "extern PFN_%s _glptr_%s;\n",
-            command.name.c_str(),
-            command.name.c_str());
+    output_h_ // Function pointer type.
+        << "\ntypedef " << command.return_ctype << " (GL_APIENTRY *PFN_"
+        << command.name << ")(" << parameter_list_sig_ << ");\n";
+    output_h_ // Declaration.
+        << "extern PFN_" << command.name << " _glptr_" << command.name
+        << ";\n";
 
     // Add a macro that defines the command name to call the function pointer.
-    fprintf(output_h_, "#define %s _glptr_%s\n",
-            command.name.c_str(),
-            command.name.c_str());
+    output_h_ << "#define " << command.name << " _glptr_" << command.name
+              << '\n';
     if (!command.alias.empty()) {
-      fprintf(output_h_,
-              "#define %s %s\n",
-              command.alias.c_str(),
-              command.name.c_str());
+      output_h_ << "#define " << command.alias << ' ' << command.name << '\n';
     }
 
     // Output loader function to .c file.
-    fprintf(output_c_, // Signature.
-            "static %s GL_APIENTRY _impl_%s (%s) {\n",
-            command.return_ctype.c_str(),
-            command.name.c_str(),
-            parameter_list_sig.c_str());
+    output_c_ // Signature.
+        << "static " << command.return_ctype << " GL_APIENTRY _impl_"
+        << command.name << " (" << parameter_list_sig_ << ") {\n";
+    bool returns_value = command.return_ctype != "void";
     if (null_driver_) {
-      if (command.return_ctype != "void") {
-        fprintf(output_c_,
-                "  return (%s)0;\n", command.return_ctype.c_str());
+      if (returns_value) {
+        output_c_ << "  return (" << command.return_ctype << ")0;\n";
       }
-      fprintf(output_c_, "}\n");
+      output_c_ << "}\n";
     } else {
-      fprintf(output_c_, // Implementation.
-              "  _glptr_%s = (PFN_%s)GalogenGetProcAddress(\"%s\");\n  ",
-              command.name.c_str(),
-              command.name.c_str(),
-              command.name.c_str());
-      fprintf(output_c_,
-              "%s _glptr_%s(%s);\n}\n",
-              command.return_ctype != "void" ? "return" : "",
-              command.name.c_str(),
-              parameter_list_call.c_str());
-    }
-    fprintf(output_c_, // Definition of the function pointer.
-            "PFN_%s _glptr_%s = _impl_%s;\n\n",
-            command.name.c_str(),
-            command.name.c_str(),
-            command.name.c_str());
+      output_c_ // Implementation.
+          << "  _glptr_" << command.name << " = (PFN_" << command.name
+          << ")GalogenGetProcAddress(\"" << command.name << "\");\n  "
+          << (returns_value ? "return" : "") << " _glptr_" << command.name
+          << '(' << parameter_list_call_ << ");\n}\n";
+    }
+    output_c_ // Definition of the function pointer.
+        << "PFN_" << command.name << " _glptr_" << command.name
+        << " = _impl_" << command.name << ";\n\n";
   }
   
   // Invoked at the end of output generation.
   void end() override {
-    fprintf(output_h_, "#if defined(__cplusplus)\n}\n#endif\n");
-    fprintf(output_h_, "#endif\n");
-    fclose(output_h_);
-    fclose(output_c_);
+    output_h_ << "#if defined(__cplusplus)\n}\n#endif\n";
+    output_h_ << "#endif\n";
+    writeFile(name_ + ".h", output_h_.contents());
+    writeFile(name_ + ".c", output_c_.contents());
   }
+
+  size_t headerBytes() const override { return output_h_.contents().size(); }
+  size_t sourceBytes() const override { return output_c_.contents().size(); }
   
 private:
-  FILE *output_h_;
-  FILE *output_c_;
+  static const size_t kInitialHeaderSize = 512 * 1024;
+  static const size_t kInitialSourceSize = 512 * 1024;
+
+  std::string name_;
+  OutputBuffer output_h_;
+  OutputBuffer output_c_;
+  OutputBuffer parameter_list_sig_;
+  OutputBuffer parameter_list_call_;
   bool null_driver_ = false;
 };
 
@@ -919,6 +6344,18 @@ Options:
   --exts - A comma-separated list of extensions. Default is empty. 
   --filename - Name for generated files (<api>_<ver>_<profile> by default). 
   --generator - Which generator to use. Default is "c_noload". 
+  --usage-dirs - A comma-separated list of source directories. If given, only the commands and enums whose names occur in the C, C++ and Objective-C files in these directories are generated (all types are kept). Default is empty.
+  --usage-cache - Path to an index of the identifiers used by each file in the usage directories. Later runs only read the files that changed since. Default is empty.
+  --xml-parser - Which XML parser to read the registry with. Allowed values are "streaming", "tinyxml2" and "parallel". Default is "streaming".
+  --lazy-commands - Whether commands are only parsed once a target needs them. Allowed values are "yes" and "no". Default is "yes". Has no effect with "--xml-parser tinyxml2" or "--cache".
+  --cache - Path to a registry snapshot file. The snapshot is created on the first run and reused by later runs, as long as the registry file does not change.
+  --timings - Print the wall and CPU time spent in each phase of the run to stderr, either as a table ("text") or as JSON ("json"). Times are summed over all targets; some phases contain others.
+  --stats - Print allocation counts, peak memory use, the number of entities loaded from the registry and emitted, and the size of the generated files to stderr, either as a table ("text") or as JSON ("json").
+  --batch - Path to a batch manifest. Each line of the manifest lists options for one target (e.g. "--api gles2 --ver 3.0 --filename gles30"); all targets are generated from a single load of the registry. Options given on the command line apply to every target unless overridden.
+  --jobs - Maximum number of targets to generate in parallel in batch and server mode, and number of threads reading the registry with "--xml-parser parallel". Default is the number of hardware threads.
+  --serve - Keep the registry loaded and generate targets on request. Either "stdio" (read requests from stdin, write responses to stdout) or "unix:<socket path>" (accept connections on a UNIX socket). Each request is a JSON object on a line of its own, e.g. {"id": 1, "api": "gles2", "ver": "3.0", "exts": ["KHR_debug"], "filename": "gles30"}; each response is a line such as {"id": 1, "ok": true} or {"id": 1, "ok": false, "error": "..."}. Options given on the command line are defaults for every request.
+  
+  galogen --client unix:<socket path> - Send requests read from stdin to a server and print the responses.
   
 Example:
   ./galogen gl.xml --api gl --ver 4.5 --profile core --filename gl
@@ -1022,9 +6459,12 @@ static void* GalogenGetProcAddress(const char *name)
 )STR";
 
 void createGenerators(GeneratorMap &g) {
-  g["c_noload"] = std::unique_ptr<OutputGenerator>(new COutputGenerator());
-  g["c_nulldriver"] =
-      std::unique_ptr<OutputGenerator>(new COutputGenerator(true));
+  g["c_noload"] = []() {
+    return std::unique_ptr<OutputGenerator>(new COutputGenerator());
+  };
+  g["c_nulldriver"] = []() {
+    return std::unique_ptr<OutputGenerator>(new COutputGenerator(true));
+  };
 }
 
 }
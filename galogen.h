@@ -0,0 +1,153 @@
+/*
+Copyright 2019 Google LLC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    https://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/**
+ * Interface for using Galogen as a library.
+ *
+ * Build galogen.cpp and third_party/tinyxml2.cpp into your program with
+ * GALOGEN_LIBRARY defined, which leaves out main(). Errors are returned to
+ * the caller; nothing in this interface exits the process.
+ *
+ *   galogen::Registry registry;
+ *   std::string error;
+ *   if (!registry.load("gl.xml", &error)) { ... }
+ *   galogen::Target target;
+ *   target.api = "gles2";
+ *   target.version = "3.0";
+ *   galogen::MemorySink sink;
+ *   if (!galogen::generate(registry, target, &sink, &error)) { ... }
+ *   // sink.files() now holds "gl.h" and "gl.c".
+ */
+
+#ifndef GALOGEN_H_
+#define GALOGEN_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace galogen {
+
+namespace internal {
+struct Registry;
+}
+
+// Receives the files produced by an output generator.
+class OutputSink {
+public:
+  virtual ~OutputSink() = default;
+
+  // Stores a generated file. Returns false and sets `*error` on failure.
+  virtual bool write(const std::string &file_name,
+                     const std::string &contents,
+                     std::string *error) = 0;
+};
+
+// Writes generated files to disk, leaving files whose contents did not change
+// untouched.
+class FileSink : public OutputSink {
+public:
+  bool write(const std::string &file_name,
+             const std::string &contents,
+             std::string *error) override;
+};
+
+// Keeps generated files in memory, by file name. Not safe to share between
+// concurrent calls to generate().
+class MemorySink : public OutputSink {
+public:
+  bool write(const std::string &file_name,
+             const std::string &contents,
+             std::string * /*error*/) override {
+    files_[file_name] = contents;
+    return true;
+  }
+
+  const std::map<std::string, std::string>& files() const { return files_; }
+
+private:
+  std::map<std::string, std::string> files_;
+};
+
+// Describes what to generate. The fields take the same values as the command
+// line options of the same names.
+struct Target {
+  // "gl", "gles1", "gles2" or "glsc2".
+  std::string api = "gl";
+
+  // E.g. "4.5". If empty, the default version for the API is used.
+  std::string version;
+
+  // "core" or "compatibility".
+  std::string profile = "compatibility";
+
+  // Extension names, with or without the "GL_" prefix.
+  std::vector<std::string> extensions;
+
+  // "c_noload" or "c_nulldriver".
+  std::string generator = "c_noload";
+
+  // Name of the generated files, without extension.
+  std::string filename = "gl";
+
+  // If not empty, only the commands and enums named in the sources in these
+  // directories are generated.
+  std::vector<std::string> usage_dirs;
+
+  // If not empty, path of a file in which the identifiers found in each file
+  // under `usage_dirs` are kept, so that later calls only read changed files.
+  std::string usage_cache;
+};
+
+// A parsed GL registry. Once loaded, any number of targets may be generated
+// from it, also concurrently from multiple threads.
+class Registry {
+public:
+  Registry();
+  ~Registry();
+  Registry(Registry&&);
+  Registry& operator=(Registry&&);
+
+  // Loads the registry from an XML file such as gl.xml. Returns false and sets
+  // `*error` on failure, in which case the registry is left empty.
+  bool load(const std::string &file_name, std::string *error);
+
+  bool loaded() const { return registry_ != nullptr; }
+
+private:
+  friend bool generate(const Registry&,
+                       const Target&,
+                       OutputSink*,
+                       std::string*,
+                       std::vector<std::string>*);
+
+  std::unique_ptr<internal::Registry> registry_;
+};
+
+// Generates a target from a loaded registry and hands the resulting files to
+// `sink`. Returns false and sets `*error` on failure. Problems that do not
+// stop generation, such as a requested extension that the API does not
+// support, are appended to `*warnings` if it is not null.
+bool generate(const Registry &registry,
+              const Target &target,
+              OutputSink *sink,
+              std::string *error,
+              std::vector<std::string> *warnings = nullptr);
+
+}
+
+#endif